@@ -5,7 +5,9 @@
 
 /**
  * \file
- *         Anycast implementation file
+ *         Anycast implementation file. Built with ANYCAST_CONF_CACHE_SIZE,
+ *	   it caches the servers chosen, and nodes with a cached server
+ *	   answer floods for its anycast address on the server's behalf.
  * \author
  *         Wei Qiao Toh
  */
@@ -14,8 +16,12 @@
 #include "contiki.h"
 #include "lib/list.h"
 #include "lib/memb.h"
+#include "lib/random.h"
 #include "dev/leds.h"
+#include "net/queuebuf.h"
+#include "net/rime/route.h"
 #include <stdio.h>
+#include <string.h>
 #include <stddef.h> /* For offsetof */
 
 /**
@@ -40,12 +46,44 @@
 }
 
 /**
- * \brief Stores anycast address nodes listens on
+ * \brief Values of the slot of a timer that is not on the timer wheel
  */
-struct anycast_bind_address {
-	struct anycast_bind_address *next;
+#define WHEEL_IDLE 0
+#define WHEEL_EXPIRING 0xff
+
+/**
+ * \brief Ring of a served discovery that was not answered yet
+ */
+#define SERVED_NONE 0xff
+
+/**
+ * \brief Number of fragments of a message of the given length
+ */
+#define FRAG_COUNT(len) (((len) + ANYCAST_FRAG_LEN - 1) / ANYCAST_FRAG_LEN)
+
+/**
+ * \brief Timer of the timer wheel, embedded in the structure it expires
+ */
+struct wheel_timer {
+	struct wheel_timer *next;
+	/* full turns of the wheel left before expiry */
+	uint16_t rounds;
+	/* slot + 1 on the wheel, WHEEL_IDLE or WHEEL_EXPIRING */
+	uint8_t slot;
+	void (* expired)(struct wheel_timer *t);
+};
+
+/**
+ * \brief For flooding an anycast request. Data is only carried in eager mode.
+ */
+struct anycast_req {
 	anycast_addr_t address;
-};	
+	uint8_t flag;
+	uint8_t seq_number;
+	/* hop radius of the ring, 0 for the whole network */
+	uint8_t max_hops;
+	char data[ANYCAST_EAGER_LEN];
+};
 
 /**
  * \brief For responding to an anycast request
@@ -54,139 +92,2799 @@ struct anycast_res {
 	uint8_t flag;
 	uint8_t seq_number;
 	anycast_addr_t address;
+	/* server answering the request, which differs from the sender of a
+	   proxy response */
+	rimeaddr_t server;
+	/* hops between the sender and the server, 0 unless proxied */
+	uint8_t hops;
+	/* load declared by the server, 0 idle to 255 saturated */
+	uint8_t load;
+	/* node that started the discovery */
+	rimeaddr_t client;
+};
+
+/**
+ * \brief For sending data to an anycast server. Only the first len bytes of
+ *	  data are transmitted, and they may hold any binary value.
+ */
+struct anycast_data {
+	uint8_t flag;
+	anycast_addr_t address;
+	uint8_t len;
+	char data[ANYCAST_DATA_LEN];
+};
+
+/**
+ * \brief For advertising an anycast address and its distance in hops
+ */
+struct anycast_adv_entry {
+	anycast_addr_t address;
+	uint8_t hops;
+	/* next hop of the gradient, the advertiser itself for a server */
+	rimeaddr_t nexthop;
+};
+
+/**
+ * \brief For advertising the anycast addresses a node can reach
+ */
+struct anycast_adv {
+	uint8_t flag;
+	uint8_t count;
+	struct anycast_adv_entry entries[ANYCAST_ADV_ENTRIES];
+};
+
+/**
+ * \brief For forwarding data along the gradient to an anycast server
+ */
+struct anycast_fwd {
+	uint8_t flag;
+	anycast_addr_t address;
+	uint8_t ttl;
+	rimeaddr_t originator;
+	char data[ANYCAST_DATA_LEN];
+};
+
+/**
+ * \brief Next hop toward the nearest server of an anycast address, learned
+ *	  from advertisements in proactive mode
+ */
+struct anycast_gradient {
+	struct anycast_gradient *next;
+	anycast_addr_t address;
+	rimeaddr_t nexthop;
+	uint8_t hops;
+	struct anycast_conn *conn;
+	struct wheel_timer timer;
+};
+
+/**
+ * \brief For sending several data records to an anycast server in one frame.
+ *	  Every record is its length in one byte followed by its data.
+ */
+struct anycast_batch {
+	uint8_t flag;
+	anycast_addr_t address;
+	uint8_t count;
+	uint8_t data[ANYCAST_DATA_LEN];
+};
+
+#if ANYCAST_MAX_MSG_LEN > 0
+/**
+ * \brief For sending a fragment of a message larger than ANYCAST_DATA_LEN.
+ *	  Every fragment but the last carries ANYCAST_FRAG_LEN bytes.
+ */
+struct anycast_frag {
+	uint8_t flag;
+	anycast_addr_t address;
+	uint8_t msg_id;
+	uint8_t index;
+	uint8_t count;
+	/* non-zero on the last fragment of a round */
+	uint8_t ack_req;
+	uint8_t data[ANYCAST_FRAG_LEN];
+};
+
+/**
+ * \brief For acknowledging the fragments received, one bit per fragment
+ */
+struct anycast_frag_ack {
+	uint8_t flag;
+	anycast_addr_t address;
+	uint8_t msg_id;
+	uint16_t sack;
+};
+
+/**
+ * \brief Reassembly buffer of a fragmented message. It is kept after the
+ *	  message has been delivered so that repeated fragments are only
+ *	  acknowledged again.
+ */
+struct anycast_reassembly {
+	struct anycast_conn *conn;
+	rimeaddr_t originator;
+	anycast_addr_t address;
+	uint8_t msg_id;
+	uint8_t count;
+	uint8_t done;
+	uint16_t received;
+	uint16_t len;
+	struct wheel_timer timer;
+	uint8_t data[ANYCAST_MAX_MSG_LEN];
+};
+#endif /* ANYCAST_MAX_MSG_LEN > 0 */
+
+/**
+ * \brief For sending data that the server acknowledges in reliable mode
+ */
+struct anycast_rdata {
+	uint8_t flag;
+	anycast_addr_t address;
+	uint8_t msg_id;
+	uint8_t data[ANYCAST_DATA_LEN];
+};
+
+/**
+ * \brief For acknowledging data received in reliable mode
+ */
+struct anycast_ack {
+	uint8_t flag;
+	anycast_addr_t address;
+	uint8_t msg_id;
+};
+
+/**
+ * \brief For sending a request to a server in an exchange, and the reply
+ *	  of the server back to the client
+ */
+struct anycast_rpc {
+	uint8_t flag;
+	anycast_addr_t address;
+	uint8_t rpc_id;
+	uint8_t data[ANYCAST_DATA_LEN];
+};
+
+/**
+ * \brief For checking that the server of a session is still reachable, and
+ *	  for the answer of the server
+ */
+struct anycast_keepalive {
+	uint8_t flag;
+	anycast_addr_t address;
+};
+
+/**
+ * \brief Reliable message recently received, to detect retransmissions
+ */
+struct anycast_seen {
+	rimeaddr_t originator;
+	uint8_t msg_id;
+};
+
+/**
+ * \brief Data structure for each requests made by application. The payload
+ *	  is kept as handed over in the packetbuf until it is sent.
+ */
+struct anycast_send_buffer {
+	struct anycast_send_buffer *next;
+	anycast_addr_t address;
+	uint8_t seq_number;
+	struct queuebuf *buf;
+	anycast_handle_t handle;
+	/* reliable mode: servers and retransmission state of the message */
+	struct anycast_conn *conn;
+	rimeaddr_t server;
+	rimeaddr_t alt;
+	uint8_t has_alt;
+	uint8_t msg_id;
+	uint8_t tries;
+	uint8_t rediscovered;
+	/* non-zero for a request answered with anycast_reply() */
+	uint8_t rpc;
+	struct wheel_timer timer;
+};
+
+/**
+ * \brief Data structure for an anycast server discovery in progress. Send
+ *	  requests to the same anycast address join the outstanding discovery
+ *	  instead of flooding the network again.
+ */
+struct anycast_discovery {
+	anycast_addr_t address;
+	uint8_t seq_number;
+	struct anycast_conn *conn;
+	struct wheel_timer timer;
+	/* hop radius of the current ring, 0 for the whole network */
+	uint8_t ring;
+	/* time the current ring was flooded at */
+	clock_time_t start;
+	/* hops beyond which a response can only answer the current ring */
+	uint8_t karn_hops;
+	/* window to collect responses once the first one arrived */
+	clock_time_t window;
+	/* cheapest anycast server that responded so far, see server_cost() */
+	rimeaddr_t server;
+	uint8_t hops;
+	uint8_t load;
+	uint16_t cost;
+	uint8_t found;
+	/* next cheapest server that responded, for failover in reliable mode */
+	rimeaddr_t alt;
+	uint16_t alt_cost;
+	uint8_t has_alt;
+	/* non-zero if the fragmented message of conn waits for this discovery */
+	uint8_t frag;
+	/* send requests waiting for this discovery to complete */
+	LIST_STRUCT(requests);
+};
+
+/**
+ * \brief Response of a server waiting for its backoff to be over. It is
+ *	  dropped if a response of a server as good is overheard meanwhile.
+ */
+struct anycast_reply {
+	struct anycast_reply *next;
+	struct anycast_conn *conn;
+	struct anycast_res res;
+	/* hops between the client and this server */
+	uint8_t hops;
+	struct ctimer ctimer;
+};
+
+#if ANYCAST_CACHE_SIZE > 0
+/**
+ * \brief For caching anycast server to their RIME address
+ */
+struct anycast_server_cache {
+	struct anycast_server_cache *next;
+	anycast_addr_t anycast_addr;
+	rimeaddr_t rime_addr;	
+	/* hops to the anycast server */
+	uint8_t hops;
+	/* load the anycast server declared when it was chosen */
+	uint8_t load;
+	/* grows while the server keeps taking data */
+	clock_time_t lifetime;
+	struct wheel_timer timer;
+};
+
+/**
+ * \brief Allocate memory for ANYCAST_CACHE_SIZE anycast-to-rime addresses
+ */
+MEMB(anycast_cache_mem, struct anycast_server_cache, ANYCAST_CACHE_SIZE);
+
+/**
+ * \brief Declare linked-list that caches anycast-to-rime addresses, most
+ *	  recently used first
+ */
+LIST(anycast_cache);
+#endif /* ANYCAST_CACHE_SIZE > 0 */
+
+#if ANYCAST_UNREACHABLE_NUM > 0
+/**
+ * \brief Anycast address for which no server was found
+ */
+struct anycast_unreachable {
+	struct anycast_unreachable *next;
+	anycast_addr_t address;
+	/* discoveries that failed in a row */
+	uint8_t failures;
+	/* non-zero while sends to the address are refused */
+	uint8_t backoff;
+	struct wheel_timer timer;
+};
+
+/**
+ * \brief Allocate memory for ANYCAST_UNREACHABLE_NUM unserved addresses
+ */
+MEMB(unreachable_mem, struct anycast_unreachable, ANYCAST_UNREACHABLE_NUM);
+
+/**
+ * \brief Declare linked-list of the unserved addresses, most recent first
+ */
+LIST(unreachables);
+#endif /* ANYCAST_UNREACHABLE_NUM > 0 */
+
+#if ANYCAST_RTT_NUM > 0
+/**
+ * \brief Round-trip time of the discoveries for an anycast address, in
+ *	  clock ticks. srtt is kept times 8 and rttvar times 4.
+ */
+struct anycast_rtt {
+	struct anycast_rtt *next;
+	anycast_addr_t address;
+	clock_time_t srtt;
+	clock_time_t rttvar;
+	/* hops to the server of the last sample */
+	uint8_t hops;
+	/* discoveries that timed out since the last sample */
+	uint8_t backoff;
 };
 
 /**
- * \brief For sending data to an anycast server
+ * \brief Allocate memory for the estimates of ANYCAST_RTT_NUM addresses
+ */
+MEMB(rtt_mem, struct anycast_rtt, ANYCAST_RTT_NUM);
+
+/**
+ * \brief Declare linked-list of the estimates, most recently sampled first
+ */
+LIST(rtts);
+#endif /* ANYCAST_RTT_NUM > 0 */
+
+/**
+ * \brief Allocate memory for anycast send requests
+ */
+MEMB(send_buf_mem, struct anycast_send_buffer, ANYCAST_SEND_BUF_NUM);
+
+/**
+ * \brief Allocate memory for outstanding anycast discoveries
+ */
+MEMB(discovery_mem, struct anycast_discovery, ANYCAST_DISCOVERY_NUM);
+
+/**
+ * \brief Outstanding anycast discoveries indexed by their sequence number.
+ *	  A discovery only takes a sequence number whose slot is free, so a
+ *	  response is matched with a single lookup.
+ */
+static struct anycast_discovery *discovery_slots[ANYCAST_DISCOVERY_SLOTS];
+
+/**
+ * \brief Allocate memory for the gradients learned in proactive mode
+ */
+MEMB(gradient_mem, struct anycast_gradient, ANYCAST_GRADIENT_SIZE);
+
+/**
+ * \brief Declare linked-list that stores the gradients toward anycast servers
+ */
+LIST(gradients);
+
+/**
+ * \brief Allocate memory for the responses waiting for their backoff
+ */
+MEMB(reply_mem, struct anycast_reply, ANYCAST_REPLY_NUM);
+
+/**
+ * \brief Declare linked-list that stores the responses waiting for their backoff
+ */
+LIST(replies);
+
+#if ANYCAST_MAX_MSG_LEN > 0
+/**
+ * \brief Reassembly buffer shared by all connections, as a server only
+ *	  receives one fragmented message at a time
+ */
+static struct anycast_reassembly reasm;
+#endif
+
+/**
+ * \brief Declare linked-list that stores reliable messages waiting for their
+ *	  acknowledgement
+ */
+LIST(unacked);
+
+/**
+ * \brief Declare linked-list that stores requests waiting for their reply
+ */
+LIST(rpcs);
+
+/**
+ * \brief Declare linked-list that stores the open sessions
+ */
+LIST(sessions);
+
+/**
+ * \brief Reliable messages received last, as a ring
+ */
+static struct anycast_seen seen[ANYCAST_SEEN_NUM];
+static uint8_t seen_next;
+
+/* handle of the next packet sent */
+static uint16_t next_handle;
+
+/** 
+ * \brief sequence number which is incremented for each send request
+ */
+static uint8_t seq_no = 0;
+
+/**
+ * \brief Non-zero once the memory pools have been initialized
+ */
+static uint8_t pools_ready = 0;
+
+/**
+ * \brief Slots of the timer wheel, each a list of timers
+ */
+static void *wheel[ANYCAST_WHEEL_SLOTS];
+
+/**
+ * \brief Declare linked-list of timers expiring during the current tick
+ */
+LIST(wheel_expired);
+
+/**
+ * \brief Current slot of the timer wheel and number of timers on the wheel
+ */
+static uint8_t wheel_pos = 0;
+static uint16_t wheel_count = 0;
+
+/**
+ * \brief Single callback timer ticking the timer wheel
+ */
+static struct ctimer wheel_ctimer;
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Debug process to print rime address, anycast listening address
+ * 		and send buffer content periodically.
+ */
+PROCESS(status_process, "Print addresses/requests buffer periodically");
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Stops a timer of the timer wheel
+ * \param t	Pointer to the timer
+ *
+ *		This function does nothing if the timer is not running.
+ */
+static void
+wheel_stop(struct wheel_timer *t)
+{
+	if(t->slot == WHEEL_EXPIRING) {
+		/* expiring during the current tick, don't call it back */
+		list_remove(wheel_expired, t);
+	} else if(t->slot != WHEEL_IDLE) {
+		list_remove(&wheel[t->slot - 1], t);
+		if(--wheel_count == 0) {
+			ctimer_stop(&wheel_ctimer);
+		}
+	}
+	t->slot = WHEEL_IDLE;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Called by the callback timer on every tick of the timer wheel
+ * \param ptr	Not used
+ *
+ *		This function advances the wheel by one slot. Timers of the slot
+ *		with no round left expire, the others wait one more round. The
+ *		callback timer stops once no timer is left on the wheel.
+ */
+static void
+wheel_tick(void *ptr)
+{
+	struct wheel_timer *t, *next;
+
+	wheel_pos = (wheel_pos + 1) % ANYCAST_WHEEL_SLOTS;
+
+	for(t = wheel[wheel_pos]; t != NULL; t = next) {
+		next = t->next;
+		if(t->rounds > 0) {
+			t->rounds--;
+		} else {
+			list_remove(&wheel[wheel_pos], t);
+			list_add(wheel_expired, t);
+			t->slot = WHEEL_EXPIRING;
+			wheel_count--;
+		}
+	}
+
+	while((t = list_pop(wheel_expired)) != NULL) {
+		t->slot = WHEEL_IDLE;
+		t->expired(t);
+	}
+
+	if(wheel_count > 0) {
+		ctimer_reset(&wheel_ctimer);
+	}
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Sets a timer of the timer wheel
+ * \param t	Pointer to the timer
+ * \param interval Time until the timer expires, rounded up to a wheel tick
+ * \param expired Function called when the timer expires
+ *
+ *		This function restarts the timer if it is already running.
+ *		The interval may exceed a 16-bit clock_time_t, as gradients
+ *		live for several maximum advertisement intervals.
+ */
+static void
+wheel_set(struct wheel_timer *t, unsigned long interval,
+	void (* expired)(struct wheel_timer *t))
+{
+	unsigned long ticks;
+
+	wheel_stop(t);
+
+	ticks = (interval + ANYCAST_WHEEL_TICK - 1) / ANYCAST_WHEEL_TICK;
+	if(ticks == 0) {
+		ticks = 1;
+	}
+
+	t->expired = expired;
+	t->slot = (wheel_pos + ticks) % ANYCAST_WHEEL_SLOTS + 1;
+	t->rounds = (ticks - 1) / ANYCAST_WHEEL_SLOTS;
+	list_push(&wheel[t->slot - 1], t);
+
+	if(wheel_count++ == 0) {
+		ctimer_set(&wheel_ctimer, ANYCAST_WHEEL_TICK, wheel_tick, NULL);
+	}
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Returns an outstanding anycast discovery
+ * \param addr	Anycast address the application sends to
+ * \param seq_no Sequence number the anycast request was flooded with
+ *
+ *             This function returns the pointer to the discovery stored in
+ *             the linked-list, or NULL if the discovery is not outstanding
+ *             anymore.
+ */
+static struct anycast_discovery *
+discovery_lookup(const anycast_addr_t addr, const uint8_t seq_no)
+{
+	struct anycast_discovery *d;
+
+	d = discovery_slots[seq_no % ANYCAST_DISCOVERY_SLOTS];
+	if(d != NULL && d->address == addr && d->seq_number == seq_no) {
+		return d;
+	}
+	return NULL;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Returns the outstanding discovery for an anycast address
+ * \param c	The anycast connection the discovery was started on
+ * \param addr	Anycast address the application sends to
+ *
+ *             This function returns the discovery already in flight for
+ *             the anycast address, or NULL if there is none.
+ */
+static struct anycast_discovery *
+discovery_pending(const struct anycast_conn *c, const anycast_addr_t addr)
+{
+	struct anycast_discovery *d;
+	uint8_t i;
+
+	for(i = 0; i < ANYCAST_DISCOVERY_SLOTS; i++) {
+		d = discovery_slots[i];
+		if(d != NULL && d->conn == c && d->address == addr) {
+			return d;
+		}
+	}
+	return NULL;
+}
+/*---------------------------------------------------------------------------*/
+#if ANYCAST_UNREACHABLE_NUM > 0
+/**
+ * \brief	Returns the entry of an anycast address no server was found for
+ * \param addr	Anycast address the application sends to
+ */
+static struct anycast_unreachable *
+unreachable_lookup(const anycast_addr_t addr)
+{
+	struct anycast_unreachable *u;
+
+	for(u = list_head(unreachables); u != NULL; u = u->next) {
+		if(u->address == addr) {
+			return u;
+		}
+	}
+	return NULL;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Returns the backoff of an unserved anycast address
+ * \param u	Pointer to the entry of the address
+ *
+ *		The backoff starts at ANYCAST_UNREACHABLE_BACKOFF and doubles
+ *		with every discovery that failed in a row, up to
+ *		ANYCAST_UNREACHABLE_BACKOFF_MAX.
+ */
+static clock_time_t
+unreachable_backoff(const struct anycast_unreachable *u)
+{
+	clock_time_t backoff = ANYCAST_UNREACHABLE_BACKOFF;
+	uint8_t i;
+
+	for(i = 1; i < u->failures &&
+		backoff < ANYCAST_UNREACHABLE_BACKOFF_MAX / 2; i++) {
+		backoff *= 2;
+	}
+	return i < u->failures ? ANYCAST_UNREACHABLE_BACKOFF_MAX : backoff;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Called by the timer wheel when a backoff is over
+ * \param t	Pointer to the timer of the entry
+ *
+ *		Sends to the address are accepted again once the backoff is
+ *		over. The failures are remembered for as long again, so that
+ *		the next failed discovery doubles the backoff, then the entry
+ *		is removed.
+ */
+static void
+unreachable_expired(struct wheel_timer *t)
+{
+	struct anycast_unreachable *u = (struct anycast_unreachable *)
+		((char *)t - offsetof(struct anycast_unreachable, timer));
+
+	if(u->backoff) {
+		PRINTF("[UNREACH]\tBackoff of anycast %u over.\n", u->address);
+
+		u->backoff = 0;
+		wheel_set(&u->timer, unreachable_backoff(u), unreachable_expired);
+		return;
+	}
+
+	list_remove(unreachables, u);
+	memb_free(&unreachable_mem, u);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Refuses sends to an anycast address no server was found for
+ * \param addr	Anycast address of the discovery that failed
+ *
+ *		The oldest entry makes room for a new one when the table is
+ *		full.
+ */
+static void
+unreachable_add(const anycast_addr_t addr)
+{
+	struct anycast_unreachable *u;
+
+	u = unreachable_lookup(addr);
+	if(u == NULL) {
+		u = memb_alloc(&unreachable_mem);
+		if(u == NULL) {
+			u = list_chop(unreachables);
+			wheel_stop(&u->timer);
+		}
+		u->address = addr;
+		u->failures = 0;
+		list_push(unreachables, u);
+	}
+
+	if(u->failures < 0xff) {
+		u->failures++;
+	}
+	u->backoff = 1;
+	wheel_set(&u->timer, unreachable_backoff(u), unreachable_expired);
+
+	PRINTF("[UNREACH]\tNo server for anycast %u, %u failures, backoff %lu ticks.\n",
+		addr,
+		u->failures,
+		(unsigned long)unreachable_backoff(u));
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Forgets the failures of an anycast address a server was found for
+ * \param addr	Anycast address of the discovery
+ */
+static void
+unreachable_clear(const anycast_addr_t addr)
+{
+	struct anycast_unreachable *u;
+
+	u = unreachable_lookup(addr);
+	if(u != NULL) {
+		wheel_stop(&u->timer);
+		list_remove(unreachables, u);
+		memb_free(&unreachable_mem, u);
+	}
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Checks whether sends to an anycast address are refused
+ * \param addr	Anycast address the application sends to
+ * \return	Non-zero while the address is in its backoff
+ */
+static uint8_t
+unreachable_check(const anycast_addr_t addr)
+{
+	struct anycast_unreachable *u;
+
+	u = unreachable_lookup(addr);
+	if(u != NULL && u->backoff) {
+		PRINTF("[UNREACH]\tAnycast %u unreachable, send refused.\n", addr);
+		return 1;
+	}
+	return 0;
+}
+#else
+#define unreachable_add(addr)
+#define unreachable_clear(addr)
+#define unreachable_check(addr) 0
+#endif /* ANYCAST_UNREACHABLE_NUM > 0 */
+/*---------------------------------------------------------------------------*/
+#if ANYCAST_RTT_NUM > 0
+/**
+ * \brief	Returns the estimate of an anycast address
+ * \param addr	Anycast address of the discovery
+ */
+static struct anycast_rtt *
+rtt_lookup(const anycast_addr_t addr)
+{
+	struct anycast_rtt *r;
+
+	for(r = list_head(rtts); r != NULL; r = r->next) {
+		if(r->address == addr) {
+			return r;
+		}
+	}
+	return NULL;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Adds the round-trip time of a discovery to its estimate
+ * \param addr	Anycast address of the discovery
+ * \param rtt	Time between the flood and the first response
+ * \param hops	Hops to the server of the first response
+ *
+ *		The smoothed round-trip time and its mean deviation are
+ *		updated with gains of 1/8 and 1/4, as TCP does. The estimate
+ *		of the least recently sampled address makes room for a new
+ *		one when the table is full.
+ */
+static void
+rtt_sample(const anycast_addr_t addr, clock_time_t rtt, uint8_t hops)
+{
+	struct anycast_rtt *r;
+	long err;
+
+	r = rtt_lookup(addr);
+	if(r == NULL) {
+		r = memb_alloc(&rtt_mem);
+		if(r == NULL) {
+			r = list_chop(rtts);
+		}
+		r->address = addr;
+		r->srtt = rtt << 3;
+		r->rttvar = rtt << 1;
+	} else {
+		list_remove(rtts, r);
+		err = (long)rtt - (long)(r->srtt >> 3);
+		r->srtt += err;
+		if(err < 0) {
+			err = -err;
+		}
+		r->rttvar += err - (long)(r->rttvar >> 2);
+	}
+	r->hops = hops;
+	r->backoff = 0;
+	list_push(rtts, r);
+
+	PRINTF("[RTT]\t\tAnycast %u: rtt %lu, srtt %lu, rttvar %lu ticks\n",
+		addr,
+		(unsigned long)rtt,
+		(unsigned long)(r->srtt >> 3),
+		(unsigned long)(r->rttvar >> 2));
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Returns the period to wait for a response to a discovery
+ * \param addr	Anycast address of the discovery
+ * \param ring	Hop radius of the ring, 0 for the whole network
+ * \param timeout Period to wait without an estimate
+ *
+ *		The period is srtt + 4 * rttvar, doubled for every discovery
+ *		that timed out since the last sample, and no shorter than
+ *		ANYCAST_RTO_MIN. It never exceeds timeout. A wider ring than
+ *		the distance of the server sampled, or the whole network as
+ *		ANYCAST_MAX_HOPS, is flooded because that server did not
+ *		answer and the next one may be farther: the period is scaled
+ *		by the ratio of the distances.
+ */
+static clock_time_t
+rtt_timeout(const anycast_addr_t addr, uint8_t ring, clock_time_t timeout)
+{
+	struct anycast_rtt *r = rtt_lookup(addr);
+	unsigned long rto;
+	uint8_t reach = ring != 0 ? ring : ANYCAST_MAX_HOPS;
+	uint8_t i;
+
+	if(r == NULL) {
+		return timeout;
+	}
+
+	rto = (r->srtt >> 3) + r->rttvar;
+	if(rto < ANYCAST_RTO_MIN) {
+		rto = ANYCAST_RTO_MIN;
+	}
+	if(reach > r->hops) {
+		rto = rto * reach / (r->hops > 0 ? r->hops : 1);
+	}
+	for(i = 0; i < r->backoff && rto < timeout; i++) {
+		rto *= 2;
+	}
+	return rto < timeout ? rto : timeout;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Doubles the period to wait for the next discovery of an address
+ * \param addr	Anycast address of the discovery that timed out
+ */
+static void
+rtt_backoff(const anycast_addr_t addr)
+{
+	struct anycast_rtt *r = rtt_lookup(addr);
+
+	if(r != NULL && r->backoff < ANYCAST_RTO_BACKOFF_MAX) {
+		r->backoff++;
+	}
+}
+#else
+#define rtt_sample(addr, rtt, hops)
+#define rtt_timeout(addr, ring, timeout) (timeout)
+#define rtt_backoff(addr)
+#endif /* ANYCAST_RTT_NUM > 0 */
+/*---------------------------------------------------------------------------*/
+#if ANYCAST_CACHE_SIZE > 0
+/**
+ * \brief	Returns the cached server of an anycast address
+ * \param addr	Anycast address the application sends to
+ *
+ *		This function moves the entry found to the head of the cache,
+ *		so that the tail is always the least recently used entry.
+ */
+static struct anycast_server_cache *
+cache_lookup(const anycast_addr_t addr)
+{
+	struct anycast_server_cache *cache;
+
+	for(cache = list_head(anycast_cache); cache != NULL; cache = cache->next) {
+		if(cache->anycast_addr == addr) {
+			list_remove(anycast_cache, cache);
+			list_push(anycast_cache, cache);
+			return cache;
+		}
+	}
+	return NULL;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Removes every cache entry of an unreachable server
+ * \param server Rime address of the anycast server
+ *
+ *		This function is called as soon as data to the server failed,
+ *		so that the next packet discovers another server instead of
+ *		being lost until the entry expires.
+ */
+static void
+cache_invalidate(const rimeaddr_t *server)
+{
+	struct anycast_server_cache *cache, *next;
+
+	for(cache = list_head(anycast_cache); cache != NULL; cache = next) {
+		next = cache->next;
+		if(!rimeaddr_cmp(&cache->rime_addr, server)) {
+			continue;
+		}
+
+		PRINTF("[CACHE]\t\tCache %u(%02X:%02X) invalidated.\n",
+			cache->anycast_addr,
+			cache->rime_addr.u8[1],
+			cache->rime_addr.u8[0]);
+
+		wheel_stop(&cache->timer);
+		list_remove(anycast_cache, cache);
+		memb_free(&anycast_cache_mem, cache);
+	}
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief      	Removes expired anycast-to-rime address cache
+ * \param t  	Pointer to the timer of the expired cache element
+ *
+ *             	This function is called by the timer wheel when an anycast
+ *		to rime address cache has expired. The cache would be removed
+ *		from the cache linked-list and memory would be freed.  
+ */
+static void
+expire_anycast_cache(struct wheel_timer *t)
+{
+	struct anycast_server_cache *cache = (struct anycast_server_cache *)
+		((char *)t - offsetof(struct anycast_server_cache, timer));
+	
+	PRINTF("[CACHE]\t\tCache expired -> %u[%02X:%02X]\n",
+                cache->anycast_addr,
+                cache->rime_addr.u8[1],
+                cache->rime_addr.u8[0]);
+
+	list_remove(anycast_cache, cache);
+	memb_free(&anycast_cache_mem, cache);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Caches the anycast server chosen for an anycast address
+ * \param addr	Anycast address the server listens on
+ * \param rime_addr Rime address of the anycast server
+ * \param hops	Hops to the anycast server
+ * \param load	Load declared by the anycast server
+ *
+ *		This function updates the entry of the anycast address in
+ *		place, or adds one, replacing the least recently used entry
+ *		when the cache is full. Either way the entry lives for its
+ *		lifetime again, which starts over at ANYCAST_CACHE_LIFETIME
+ *		for a new server.
+ */
+static void
+cache_update(const anycast_addr_t addr, const rimeaddr_t *rime_addr,
+	const uint8_t hops, const uint8_t load)
+{
+	struct anycast_server_cache *cache;
+
+	cache = cache_lookup(addr);
+	if(cache == NULL) {
+		cache = memb_alloc(&anycast_cache_mem);
+		if(cache == NULL) {
+			cache = list_chop(anycast_cache);
+			wheel_stop(&cache->timer);
+
+			PRINTF("[CACHE]\t\tCache %u(%02X:%02X) evicted.\n", 
+				cache->anycast_addr, 
+				cache->rime_addr.u8[1], 
+				cache->rime_addr.u8[0]);
+		}
+		cache->anycast_addr = addr;
+		rimeaddr_copy(&cache->rime_addr, &rimeaddr_null);
+		list_push(anycast_cache, cache);
+	}
+
+	if(!rimeaddr_cmp(&cache->rime_addr, rime_addr)) {
+		cache->lifetime = ANYCAST_CACHE_LIFETIME;
+	}
+
+	PRINTF("[CACHE]\t\tCache %u(%02X:%02X) %s.\n", 
+		addr, 
+		rime_addr->u8[1], 
+		rime_addr->u8[0],
+		rimeaddr_cmp(&cache->rime_addr, rime_addr) ? "renewed" : "set");
+
+	rimeaddr_copy(&cache->rime_addr, rime_addr);
+	cache->hops = hops;
+	cache->load = load;
+	wheel_set(&cache->timer, cache->lifetime, expire_anycast_cache);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Extends the cache entry of a server that took data
+ * \param addr	Anycast address the data was sent to
+ * \param server Rime address of the anycast server
+ *
+ *		The lifetime of the entry doubles, up to
+ *		ANYCAST_CACHE_LIFETIME_MAX, and starts over.
+ */
+static void
+cache_refresh(const anycast_addr_t addr, const rimeaddr_t *server)
+{
+	struct anycast_server_cache *cache;
+
+	cache = cache_lookup(addr);
+	if(cache == NULL || !rimeaddr_cmp(&cache->rime_addr, server)) {
+		return;
+	}
+
+	if(cache->lifetime < ANYCAST_CACHE_LIFETIME_MAX / 2) {
+		cache->lifetime *= 2;
+	} else {
+		cache->lifetime = ANYCAST_CACHE_LIFETIME_MAX;
+	}
+	wheel_set(&cache->timer, cache->lifetime, expire_anycast_cache);
+
+	PRINTF("[CACHE]\t\tCache %u(%02X:%02X) refreshed for %lu ticks.\n",
+		cache->anycast_addr,
+		cache->rime_addr.u8[1],
+		cache->rime_addr.u8[0],
+		(unsigned long)cache->lifetime);
+}
+#else
+#define cache_invalidate(server) ((void)(server))
+#define cache_refresh(addr, server) ((void)(server))
+#endif /* ANYCAST_CACHE_SIZE > 0 */
+/*---------------------------------------------------------------------------*/
+static void session_unbind(const rimeaddr_t *server);
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Prepends a header to the payload in the packetbuf
+ * \param hdrlen Length of the header in bytes
+ * \return	Pointer to the header, followed by the payload
+ *
+ *		This function moves the payload up within the packetbuf to make
+ *		room for the header, so that the frame is built in place without
+ *		copying the payload through an intermediate buffer. The header
+ *		stays at packetbuf_dataptr(), where mesh_sent() expects it.
+ */
+static void *
+frame_alloc(uint8_t hdrlen)
+{
+	uint8_t *ptr;
+	uint16_t len;
+
+	/* bring referenced data into the packetbuf before moving it */
+	packetbuf_compact();
+
+	ptr = packetbuf_dataptr();
+	len = packetbuf_datalen();
+	memmove(ptr + hdrlen, ptr, len);
+	packetbuf_set_datalen(len + hdrlen);
+
+	return ptr;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Returns the cost of a server that responded to a discovery
+ * \param hops	Hops to the server
+ * \param load	Load declared by the server
+ *
+ *		The cost is counted in sixteenths of a hop. A fully loaded
+ *		server costs ANYCAST_LOAD_HOPS hops more than an idle one at
+ *		the same distance.
+ */
+static uint16_t
+server_cost(uint8_t hops, uint8_t load)
+{
+	return ((uint16_t)hops << 4) +
+		(((uint16_t)load * ANYCAST_LOAD_HOPS) >> 4);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Returns a new handle for a packet sent by the application
+ */
+static anycast_handle_t
+handle_new(void)
+{
+	return (anycast_handle_t)(next_handle++ & 0x7fff);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Calls the timedout callback for every handle of a frame
+ * \param c	A pointer to a struct anycast_conn
+ * \param handles Handles of the packets in the frame
+ * \param count Number of handles
+ * \param addr	The anycast address the frame was sent to
+ * \param err_code Error code handed to the timedout callback
+ *
+ *		The handles are copied first, as the application may send
+ *		again from its callback.
+ */
+static void
+handles_timedout(struct anycast_conn *c, const anycast_handle_t *handles,
+	uint8_t count, const anycast_addr_t addr, const uint8_t err_code)
+{
+	anycast_handle_t h[ANYCAST_BATCH_RECORDS];
+	uint8_t i;
+
+	memcpy(h, handles, count * sizeof(anycast_handle_t));
+	for(i = 0; i < count; i++) {
+		if(c->cb->timedout) {
+			c->cb->timedout(c, h[i], addr, err_code);
+		}
+	}
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Sends the frame in the packetbuf over mesh
+ * \param c	A pointer to a struct anycast_conn
+ * \param to	Rime address of the receiver
+ *
+ *		The handles of a data frame are set in tx_handles beforehand.
+ *		Mesh holds a single frame while it discovers a route and drops
+ *		it for the next frame to be queued, so the packets of a dropped
+ *		data frame are reported as timed out here.
+ */
+static void
+mesh_tx(struct anycast_conn *c, const rimeaddr_t *to)
+{
+	anycast_handle_t dropped[ANYCAST_BATCH_RECORDS];
+	anycast_addr_t dropped_address = c->queued_address;
+	uint8_t count, n;
+	int sent;
+
+	rimeaddr_copy(&c->tx_server, to);
+	c->tx_busy = 1;
+	sent = mesh_send(&c->mesh_conn, to);
+	c->tx_busy = 0;
+	count = c->tx_count;
+	c->tx_count = 0;
+
+	if(sent) {
+		return;
+	}
+
+	/* the new frame takes the place of the one mesh held */
+	n = c->queued_count;
+	memcpy(dropped, c->queued_handles, n * sizeof(anycast_handle_t));
+	memcpy(c->queued_handles, c->tx_handles, count * sizeof(anycast_handle_t));
+	c->queued_count = count;
+	c->queued_address = c->tx_address;
+	rimeaddr_copy(&c->queued_server, &c->tx_server);
+
+	if(n > 0) {
+		PRINTF("[LOG]\t\tQueued mesh frame replaced.\n");
+		handles_timedout(c, dropped, n, dropped_address, ERR_NO_ROUTE);
+	}
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Sends the batch of records of a connection
+ * \param c	A pointer to a struct anycast_conn
+ *
+ *		This function packs the records collected so far into one
+ *		batch frame and sends it to the server of the batch.
+ */
+static void
+batch_flush(struct anycast_conn *c)
+{
+	struct anycast_batch *b;
+
+	ctimer_stop(&c->batch_ctimer);
+	if(c->batch_count == 0) {
+		return;
+	}
+
+	PRINTF("[BATCH]\t\tSending %u records (%u bytes) to anycast %u\n",
+		c->batch_count,
+		c->batch_len,
+		c->batch_address);
+
+	packetbuf_copyfrom(c->batch_data, c->batch_len);
+	b = frame_alloc(offsetof(struct anycast_batch, data));
+	b->flag = ANYCAST_BATCH_FLAG;
+	b->address = c->batch_address;
+	b->count = c->batch_count;
+
+	memcpy(c->tx_handles, c->batch_handles,
+		c->batch_count * sizeof(anycast_handle_t));
+	c->tx_count = c->batch_count;
+	c->tx_address = c->batch_address;
+	c->batch_count = 0;
+	c->batch_len = 0;
+
+	mesh_tx(c, &c->batch_server);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Called by the batch ctimer when the flush delay is over
+ * \param ptr	A pointer to a struct anycast_conn
+ */
+static void
+batch_timedout(void *ptr)
+{
+	batch_flush((struct anycast_conn *)ptr);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Sends the data in the packetbuf to an anycast server
+ * \param c	The anycast connection on which the data should be sent
+ * \param addr	The anycast address of the server
+ * \param server Rime address of the server
+ * \param handle Handle of the packet
+ *
+ *		This function sends the data as a data frame, or appends it as
+ *		a record to the batch of the connection when batching is
+ *		enabled. A batch is sent once the flush delay is over, once it
+ *		holds batch_threshold bytes or ANYCAST_BATCH_RECORDS records, or
+ *		before a record for another server is added.
+ */
+static void
+data_send(struct anycast_conn *c, const anycast_addr_t addr,
+	const rimeaddr_t *server, anycast_handle_t handle)
+{
+	struct anycast_data *a_data;
+	uint8_t tmp[ANYCAST_DATA_LEN];
+	uint8_t *data = packetbuf_dataptr();
+	uint16_t len = packetbuf_datalen();
+
+	if(c->batch_delay != 0 && len < ANYCAST_DATA_LEN) {
+		/* the batch is sent from the packetbuf, set the record aside */
+		if(c->batch_count > 0 && (c->batch_address != addr ||
+			!rimeaddr_cmp(&c->batch_server, server) ||
+			c->batch_len + 1 + len > ANYCAST_DATA_LEN)) {
+			memcpy(tmp, data, len);
+			data = tmp;
+			batch_flush(c);
+		}
+
+		if(c->batch_count == 0) {
+			c->batch_address = addr;
+			rimeaddr_copy(&c->batch_server, server);
+			ctimer_set(&c->batch_ctimer, c->batch_delay,
+				batch_timedout, c);
+		}
+
+		c->batch_data[c->batch_len++] = len;
+		memcpy(c->batch_data + c->batch_len, data, len);
+		c->batch_len += len;
+		c->batch_handles[c->batch_count++] = handle;
+
+		PRINTF("[BATCH]\t\tRecord of %u bytes batched for anycast %u\n",
+			len,
+			addr);
+
+		if(c->batch_len >= c->batch_threshold ||
+			c->batch_count == ANYCAST_BATCH_RECORDS) {
+			batch_flush(c);
+		}
+		return;
+	}
+
+	PRINTF("[LOG]\t\tSending data (%u bytes)...\n", len);
+
+	a_data = frame_alloc(offsetof(struct anycast_data, data));
+	a_data->flag = ANYCAST_DATA_FLAG;
+	a_data->address = addr;
+	a_data->len = len;
+
+	c->tx_handles[0] = handle;
+	c->tx_count = 1;
+	c->tx_address = addr;
+	mesh_tx(c, server);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Delivers every record of a batch frame received from a client
+ * \param c	A pointer to a struct anycast_conn
+ * \param from	Rime address of the client
+ *
+ *		The records are copied out of the packetbuf first, as the
+ *		application may use the packetbuf from its recv callback.
+ */
+static void
+batch_recv(struct anycast_conn *c, const rimeaddr_t *from)
+{
+	struct anycast_batch *b = (struct anycast_batch *)packetbuf_dataptr();
+	uint8_t buf[ANYCAST_DATA_LEN];
+	rimeaddr_t originator;
+	anycast_addr_t addr;
+	uint16_t len, i;
+	uint8_t count, n;
+
+	if(packetbuf_datalen() < offsetof(struct anycast_batch, data) ||
+		packetbuf_datalen() - offsetof(struct anycast_batch, data) >
+		ANYCAST_DATA_LEN) {
+		return;
+	}
+
+	len = packetbuf_datalen() - offsetof(struct anycast_batch, data);
+	memcpy(buf, b->data, len);
+	addr = b->address;
+	count = b->count;
+	rimeaddr_copy(&originator, from);
+
+	PRINTF("[BATCH]\t\t%u records received from %02X:%02X\n",
+		count,
+		originator.u8[1],
+		originator.u8[0]);
+
+	for(i = 0, n = 0; n < count && i < len; n++) {
+		if(i + 1 + buf[i] > len) {
+			PRINTF("[ERROR]\t\tMalformed batch from %02X:%02X.\n",
+				originator.u8[1],
+				originator.u8[0]);
+			return;
+		}
+		c->cb->recv(c, &originator, addr, (char *)buf + i + 1, buf[i]);
+		i += 1 + buf[i];
+	}
+}
+/*---------------------------------------------------------------------------*/
+#if ANYCAST_MAX_MSG_LEN > 0
+/**
+ * \brief	Returns the first fragment not acknowledged by the server
+ * \param c	A pointer to a struct anycast_conn
+ * \param i	Index of the fragment to start from
+ *
+ *		This function returns the number of fragments of the message
+ *		if every fragment from i on has been acknowledged.
+ */
+static uint8_t
+frag_missing(const struct anycast_conn *c, uint8_t i)
+{
+	uint8_t count = FRAG_COUNT(c->frag_len);
+
+	while(i < count && (c->frag_acked & ((uint16_t)1 << i))) {
+		i++;
+	}
+	return i;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Gives up the fragmented message of a connection
+ * \param c	A pointer to a struct anycast_conn
+ * \param err_code Error code handed to the timedout callback
+ */
+static void
+frag_fail(struct anycast_conn *c, const uint8_t err_code)
+{
+	PRINTF("[FRAG]\t\tMessage %u to anycast %u given up.\n",
+		c->frag_id,
+		c->frag_address);
+
+	ctimer_stop(&c->frag_ctimer);
+	c->frag_data = NULL;
+	if(err_code == ERR_NO_ROUTE) {
+		cache_invalidate(&c->frag_server);
+		session_unbind(&c->frag_server);
+	}
+
+	if(c->cb->timedout) {
+		c->cb->timedout(c, c->frag_handle, c->frag_address, err_code);
+	}
+}
+/*---------------------------------------------------------------------------*/
+static void frag_ack_timedout(void *ptr);
+/**
+ * \brief	Sends the next fragment not acknowledged yet
+ * \param ptr	A pointer to a struct anycast_conn
+ *
+ *		This function is called by the fragment ctimer. Fragments are
+ *		paced ANYCAST_FRAG_INTERVAL apart. The last fragment of a
+ *		round asks the server for a selective acknowledgement.
+ */
+static void
+frag_send_next(void *ptr)
+{
+	struct anycast_conn *c = (struct anycast_conn *)ptr;
+	struct anycast_frag *frag;
+	uint8_t count = FRAG_COUNT(c->frag_len);
+	uint8_t i, ack_req;
+	uint16_t len;
+
+	i = frag_missing(c, c->frag_next);
+	if(i >= count) {
+		ctimer_set(&c->frag_ctimer, ANYCAST_FRAG_ACK_TIMEOUT,
+			frag_ack_timedout, c);
+		return;
+	}
+	c->frag_next = frag_missing(c, i + 1);
+	ack_req = (c->frag_next >= count);
+
+	len = (i == count - 1) ? c->frag_len - i * ANYCAST_FRAG_LEN :
+		ANYCAST_FRAG_LEN;
+	packetbuf_copyfrom(c->frag_data + i * ANYCAST_FRAG_LEN, len);
+
+	frag = frame_alloc(offsetof(struct anycast_frag, data));
+	frag->flag = ANYCAST_FRAG_FLAG;
+	frag->address = c->frag_address;
+	frag->msg_id = c->frag_id;
+	frag->index = i;
+	frag->count = count;
+	frag->ack_req = ack_req;
+
+	PRINTF("[FRAG]\t\tSending fragment %u/%u of message %u (%u bytes)\n",
+		i + 1,
+		count,
+		c->frag_id,
+		len);
+
+	/* a lost fragment is covered by the acknowledgement, not by mesh */
+	mesh_tx(c, &c->frag_server);
+
+	if(ack_req) {
+		ctimer_set(&c->frag_ctimer, ANYCAST_FRAG_ACK_TIMEOUT,
+			frag_ack_timedout, c);
+	} else {
+		ctimer_set(&c->frag_ctimer, ANYCAST_FRAG_INTERVAL,
+			frag_send_next, c);
+	}
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Starts a new round with the fragments still missing
+ * \param c	A pointer to a struct anycast_conn
+ * \param delay	Time to wait before the first fragment of the round
+ */
+static void
+frag_round(struct anycast_conn *c, clock_time_t delay)
+{
+	if(++c->frag_rounds > ANYCAST_FRAG_RETRIES) {
+		frag_fail(c, ERR_NO_ROUTE);
+		return;
+	}
+
+	c->frag_next = 0;
+	ctimer_set(&c->frag_ctimer, delay, frag_send_next, c);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Called when a round of fragments was not acknowledged
+ * \param ptr	A pointer to a struct anycast_conn
+ */
+static void
+frag_ack_timedout(void *ptr)
+{
+	struct anycast_conn *c = (struct anycast_conn *)ptr;
+
+	PRINTF("[FRAG]\t\tNo acknowledgement for message %u.\n", c->frag_id);
+
+	frag_round(c, 0);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Starts streaming the fragmented message to a server
+ * \param c	A pointer to a struct anycast_conn
+ * \param server Rime address of the anycast server
+ */
+static void
+frag_start(struct anycast_conn *c, const rimeaddr_t *server)
+{
+	rimeaddr_copy(&c->frag_server, server);
+	c->frag_acked = 0;
+	c->frag_rounds = 0;
+	c->frag_next = 0;
+
+	/* leave room for data released by the same discovery */
+	ctimer_set(&c->frag_ctimer, ANYCAST_FRAG_INTERVAL, frag_send_next, c);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Handles the selective acknowledgement of a server
+ * \param c	A pointer to a struct anycast_conn
+ * \param from	Rime address of the server
+ *
+ *		This function completes the message once every fragment has
+ *		been acknowledged, or sends the missing ones again.
+ */
+static void
+frag_ack_recv(struct anycast_conn *c, const rimeaddr_t *from)
+{
+	struct anycast_frag_ack ack;
+	const uint8_t *data;
+	uint8_t count;
+
+	/* the frame may be odd-aligned in the packetbuf */
+	if(packetbuf_datalen() < sizeof(ack)) {
+		return;
+	}
+	memcpy(&ack, packetbuf_dataptr(), sizeof(ack));
+
+	if(c->frag_data == NULL || ack.msg_id != c->frag_id ||
+		!rimeaddr_cmp(from, &c->frag_server)) {
+		return;
+	}
+
+	count = FRAG_COUNT(c->frag_len);
+	c->frag_acked |= ack.sack;
+
+	PRINTF("[FRAG]\t\tMessage %u acknowledged: %04X\n",
+		c->frag_id,
+		c->frag_acked);
+
+	if(frag_missing(c, 0) >= count) {
+		data = c->frag_data;
+		ctimer_stop(&c->frag_ctimer);
+		c->frag_data = NULL;
+		cache_refresh(c->frag_address, from);
+
+		if(c->cb->sent) {
+			c->cb->sent(c, c->frag_handle, c->frag_address,
+				(char *)data, c->frag_len);
+		}
+		return;
+	}
+
+	/* the round is over, resend what the server is missing */
+	if(c->frag_next >= count) {
+		frag_round(c, ANYCAST_FRAG_INTERVAL);
+	}
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Called by the timer wheel to release the reassembly buffer
+ * \param t	Pointer to the timer of the reassembly buffer
+ */
+static void
+reasm_expired(struct wheel_timer *t)
+{
+	if(!reasm.done) {
+		PRINTF("[FRAG]\t\tIncomplete message %u from %02X:%02X dropped.\n",
+			reasm.msg_id,
+			reasm.originator.u8[1],
+			reasm.originator.u8[0]);
+	}
+	reasm.conn = NULL;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Handles a fragment received from a client
+ * \param c	A pointer to a struct anycast_conn
+ * \param from	Rime address of the client
+ *
+ *		This function copies the fragment into the reassembly buffer,
+ *		acknowledges the fragments received so far when asked to, and
+ *		delivers the message once it is complete. Fragments of another
+ *		message are dropped while the buffer is in use.
+ */
+static void
+frag_recv(struct anycast_conn *c, const rimeaddr_t *from)
+{
+	struct anycast_frag *frag = (struct anycast_frag *)packetbuf_dataptr();
+	struct anycast_frag_ack ack;
+	rimeaddr_t originator;
+	uint16_t len, offset;
+	uint8_t complete = 0;
+
+	len = packetbuf_datalen() - offsetof(struct anycast_frag, data);
+	offset = frag->index * ANYCAST_FRAG_LEN;
+
+	if(packetbuf_datalen() < offsetof(struct anycast_frag, data) ||
+		frag->count == 0 || frag->count > ANYCAST_FRAG_MAX ||
+		frag->index >= frag->count || offset + len > ANYCAST_MAX_MSG_LEN ||
+		(frag->index < frag->count - 1 && len != ANYCAST_FRAG_LEN)) {
+		PRINTF("[ERROR]\t\tMalformed fragment from %02X:%02X dropped.\n",
+			from->u8[1],
+			from->u8[0]);
+		return;
+	}
+
+	/* take over the buffer for a new message once the last one is done */
+	if(reasm.conn != c || !rimeaddr_cmp(&reasm.originator, from) ||
+		reasm.msg_id != frag->msg_id || reasm.address != frag->address) {
+		if(reasm.conn != NULL && !reasm.done) {
+			PRINTF("[FRAG]\t\tReassembly buffer busy, fragment from %02X:%02X dropped.\n",
+				from->u8[1],
+				from->u8[0]);
+			return;
+		}
+		reasm.conn = c;
+		rimeaddr_copy(&reasm.originator, from);
+		reasm.address = frag->address;
+		reasm.msg_id = frag->msg_id;
+		reasm.count = frag->count;
+		reasm.done = 0;
+		reasm.received = 0;
+		reasm.len = 0;
+		wheel_set(&reasm.timer, ANYCAST_FRAG_LIFETIME, reasm_expired);
+	}
+
+	if(!reasm.done && frag->count == reasm.count) {
+		memcpy(reasm.data + offset, frag->data, len);
+		reasm.received |= (uint16_t)1 << frag->index;
+		if(frag->index == frag->count - 1) {
+			reasm.len = offset + len;
+		}
+		if(reasm.received == (uint16_t)(((uint32_t)1 << reasm.count) - 1)) {
+			reasm.done = 1;
+			complete = 1;
+		}
+	}
+
+	PRINTF("[FRAG]\t\tFragment %u/%u of message %u from %02X:%02X\n",
+		frag->index + 1,
+		frag->count,
+		frag->msg_id,
+		from->u8[1],
+		from->u8[0]);
+
+	rimeaddr_copy(&originator, from);
+	if(frag->ack_req || complete) {
+		ack.flag = ANYCAST_FRAG_ACK_FLAG;
+		ack.address = reasm.address;
+		ack.msg_id = reasm.msg_id;
+		ack.sack = reasm.received;
+		packetbuf_copyfrom((char *)&ack, sizeof(ack));
+		mesh_tx(c, &originator);
+	}
+
+	if(complete) {
+		PRINTF("[LOG]\t\tAnycast message (%u bytes) received from %02X:%02X\n",
+			reasm.len,
+			originator.u8[1],
+			originator.u8[0]);
+
+		c->cb->recv(c, &originator, reasm.address, (char *)reasm.data,
+			reasm.len);
+	}
+}
+#endif /* ANYCAST_MAX_MSG_LEN > 0 */
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Allocates a discovery for an anycast address
+ * \param c	The anycast connection the discovery belongs to
+ * \param addr	Anycast address to discover
+ *
+ *		This function takes the next sequence number whose slot is free
+ *		for the new discovery, or returns NULL if the pool is exhausted.
+ *		The caller registers the discovery in its slot before flooding.
+ */
+static struct anycast_discovery *
+discovery_new(struct anycast_conn *c, const anycast_addr_t addr)
+{
+	struct anycast_discovery *d;
+
+	d = memb_alloc(&discovery_mem);
+	if(d == NULL) {
+		return NULL;
+	}
+
+	d->address = addr;
+	while(discovery_slots[seq_no % ANYCAST_DISCOVERY_SLOTS] != NULL) {
+		seq_no++;
+	}
+	d->seq_number = seq_no++;
+	d->conn = c;
+	d->ring = ANYCAST_RING_START;
+	d->karn_hops = 0;
+	d->window = c->collect_window;
+	d->found = 0;
+	d->has_alt = 0;
+	d->frag = 0;
+	LIST_STRUCT_INIT(d, requests);
+
+	return d;
+}
+/*---------------------------------------------------------------------------*/
+static void discovery_expired(struct wheel_timer *t);
+/**
+ * \brief	Floods the discovery request for the current ring
+ * \param d	Pointer to the discovery element
+ *
+ *		This function floods a request limited to the hop radius of
+ *		the current ring and sets the timer of the discovery to wait for a
+ *		response accordingly, or for the round-trip time estimated for
+ *		the address if it is shorter and the ring reaches no farther
+ *		than the server sampled. Every ring uses a fresh netflood
+ *		sequence number, as netflood drops packets it has seen before.
+ */
+static void
+discovery_flood(struct anycast_discovery *d)
+{
+	struct anycast_req req;
+
+	req.address = d->address;
+	req.flag = ANYCAST_REQ_FLAG;
+	req.seq_number = d->seq_number;
+	req.max_hops = d->ring;
+
+	d->start = clock_time();
+	wheel_set(&d->timer, rtt_timeout(d->address, d->ring, d->ring == 0 ?
+		ANYCAST_TIMEOUT : ANYCAST_RING_HOP_TIMEOUT * d->ring),
+		discovery_expired);
+
+	PRINTF("[LOG]\t\tDiscovering anycast %u (seq %u, ring %u).\n",
+		d->address,
+		d->seq_number,
+		d->ring);
+
+  	packetbuf_copyfrom((char *)&req, offsetof(struct anycast_req, data));
+	netflood_send(&d->conn->netflood_conn, seq_no++);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Frees a reliable send request
+ * \param s	Pointer to the send buffer element
+ */
+static void
+rdata_free(struct anycast_send_buffer *s)
+{
+	list_remove(unacked, s);
+	wheel_stop(&s->timer);
+	queuebuf_free(s->buf);
+	memb_free(&send_buf_mem, s);
+}
+/*---------------------------------------------------------------------------*/
+static void rdata_expired(struct wheel_timer *t);
+/**
+ * \brief	Sends the data of a reliable send request to its server
+ * \param s	Pointer to the send buffer element
+ *
+ *		This function frames the data with the id of the message and
+ *		waits ANYCAST_ACK_TIMEOUT for the acknowledgement, doubled with
+ *		every attempt.
+ */
+static void
+rdata_send(struct anycast_send_buffer *s)
+{
+	struct anycast_rdata *r;
+
+	queuebuf_to_packetbuf(s->buf);
+
+	PRINTF("[REL]\t\tSending message %u to %02X:%02X, attempt %u\n",
+		s->msg_id,
+		s->server.u8[1],
+		s->server.u8[0],
+		s->tries + 1);
+
+	r = frame_alloc(offsetof(struct anycast_rdata, data));
+	r->flag = ANYCAST_RDATA_FLAG;
+	r->address = s->address;
+	r->msg_id = s->msg_id;
+
+	wheel_set(&s->timer, ANYCAST_ACK_TIMEOUT << s->tries, rdata_expired);
+
+	/* a lost message is covered by the acknowledgement, not by mesh */
+	mesh_tx(s->conn, &s->server);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Starts sending a reliable send request to a server
+ * \param s	Pointer to the send buffer element
+ * \param d	Pointer to the discovery that chose the server, or NULL
+ * \param server Rime address of the server
+ */
+static void
+rdata_start(struct anycast_send_buffer *s, const struct anycast_discovery *d,
+	const rimeaddr_t *server)
+{
+	rimeaddr_copy(&s->server, server);
+	s->has_alt = 0;
+	if(d != NULL && d->has_alt) {
+		rimeaddr_copy(&s->alt, &d->alt);
+		s->has_alt = 1;
+	}
+	s->tries = 0;
+
+	list_add(unacked, s);
+	rdata_send(s);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Called by the timer wheel when a message was not acknowledged
+ * \param t	Pointer to the timer of the send buffer element
+ *
+ *		This function sends the message again up to ANYCAST_RETRIES
+ *		times. Then the server is given up for the runner-up of the
+ *		discovery, or for a new discovery once. The application is
+ *		notified with ERR_NO_ROUTE only when all of them failed.
+ */
+static void
+rdata_expired(struct wheel_timer *t)
+{
+	struct anycast_send_buffer *s = (struct anycast_send_buffer *)
+		((char *)t - offsetof(struct anycast_send_buffer, timer));
+	struct anycast_conn *c = s->conn;
+	struct anycast_discovery *d;
+	anycast_handle_t handle;
+	anycast_addr_t addr;
+
+	if(++s->tries <= ANYCAST_RETRIES) {
+		rdata_send(s);
+		return;
+	}
+
+	PRINTF("[REL]\t\tServer %02X:%02X of anycast %u stopped answering.\n",
+		s->server.u8[1],
+		s->server.u8[0],
+		s->address);
+
+	/* the cached server is stale, and so are the sessions bound to it */
+	cache_invalidate(&s->server);
+	session_unbind(&s->server);
+
+	/* fail over to the next nearest server that responded */
+	if(s->has_alt) {
+		rimeaddr_copy(&s->server, &s->alt);
+		s->has_alt = 0;
+		s->tries = 0;
+		rdata_send(s);
+		return;
+	}
+
+	/* look for another server once before giving up */
+	if(!s->rediscovered) {
+		d = discovery_pending(c, s->address);
+		if(d == NULL) {
+			d = discovery_new(c, s->address);
+			if(d != NULL) {
+				discovery_slots[d->seq_number % ANYCAST_DISCOVERY_SLOTS] = d;
+				discovery_flood(d);
+			}
+		}
+		if(d != NULL) {
+			list_remove(unacked, s);
+			s->rediscovered = 1;
+			s->seq_number = d->seq_number;
+			list_add(d->requests, s);
+			return;
+		}
+	}
+
+	handle = s->handle;
+	addr = s->address;
+	rdata_free(s);
+	if(c->cb->timedout) {
+		c->cb->timedout(c, handle, addr, ERR_NO_ROUTE);
+	}
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Handles the acknowledgement of a reliable message
+ * \param c	A pointer to a struct anycast_conn
+ * \param from	Rime address of the server
+ *
+ *		This function completes the message and calls the sent
+ *		callback of the application.
+ */
+static void
+rdata_ack_recv(struct anycast_conn *c, const rimeaddr_t *from)
+{
+	struct anycast_ack *ack = (struct anycast_ack *)packetbuf_dataptr();
+	struct anycast_send_buffer *s;
+
+	for(s = list_head(unacked); s != NULL; s = s->next) {
+		if(s->conn == c && s->msg_id == ack->msg_id &&
+			rimeaddr_cmp(&s->server, from)) {
+			break;
+		}
+	}
+	if(s == NULL) {
+		return;
+	}
+
+	PRINTF("[REL]\t\tMessage %u acknowledged by %02X:%02X\n",
+		s->msg_id,
+		from->u8[1],
+		from->u8[0]);
+
+	list_remove(unacked, s);
+	wheel_stop(&s->timer);
+	cache_refresh(s->address, from);
+	if(c->cb->sent) {
+		c->cb->sent(c, s->handle, s->address,
+			(char *)queuebuf_dataptr(s->buf),
+			queuebuf_datalen(s->buf));
+	}
+	queuebuf_free(s->buf);
+	memb_free(&send_buf_mem, s);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Acknowledges and delivers a reliable message from a client
+ * \param c	A pointer to a struct anycast_conn
+ * \param from	Rime address of the client
+ *
+ *		A message sent again because its acknowledgement was lost is
+ *		only acknowledged, not delivered twice.
+ */
+static void
+rdata_recv(struct anycast_conn *c, const rimeaddr_t *from)
+{
+	struct anycast_rdata *r = (struct anycast_rdata *)packetbuf_dataptr();
+	struct anycast_ack ack;
+	rimeaddr_t originator;
+	uint8_t i;
+
+	if(packetbuf_datalen() < offsetof(struct anycast_rdata, data)) {
+		return;
+	}
+
+	rimeaddr_copy(&originator, from);
+	ack.flag = ANYCAST_ACK_FLAG;
+	ack.address = r->address;
+	ack.msg_id = r->msg_id;
+
+	for(i = 0; i < ANYCAST_SEEN_NUM; i++) {
+		if(rimeaddr_cmp(&seen[i].originator, &originator) &&
+			seen[i].msg_id == r->msg_id) {
+			break;
+		}
+	}
+
+	if(i == ANYCAST_SEEN_NUM) {
+		rimeaddr_copy(&seen[seen_next].originator, &originator);
+		seen[seen_next].msg_id = r->msg_id;
+		seen_next = (seen_next + 1) % ANYCAST_SEEN_NUM;
+
+		PRINTF("[LOG]\t\tAnycast data (%u bytes) received from %02X:%02X (reliable)\n",
+			(unsigned)(packetbuf_datalen() - offsetof(struct anycast_rdata, data)),
+			originator.u8[1],
+			originator.u8[0]);
+
+		c->cb->recv(c, &originator, r->address, (char *)r->data,
+			packetbuf_datalen() - offsetof(struct anycast_rdata, data));
+	} else {
+		PRINTF("[REL]\t\tDuplicate message %u from %02X:%02X\n",
+			ack.msg_id,
+			originator.u8[1],
+			originator.u8[0]);
+	}
+
+	packetbuf_copyfrom((char *)&ack, sizeof(ack));
+	mesh_tx(c, &originator);
+}
+/*---------------------------------------------------------------------------*/
+static void rpc_expired(struct wheel_timer *t);
+/**
+ * \brief	Sends a request to its server and waits for the reply
+ * \param s	Pointer to the send buffer element
+ * \param server Rime address of the server
+ */
+static void
+rpc_start(struct anycast_send_buffer *s, const rimeaddr_t *server)
+{
+	struct anycast_rpc *r;
+
+	queuebuf_to_packetbuf(s->buf);
+	queuebuf_free(s->buf);
+	s->buf = NULL;
+	rimeaddr_copy(&s->server, server);
+
+	PRINTF("[RPC]\t\tSending request %u to %02X:%02X\n",
+		s->msg_id,
+		server->u8[1],
+		server->u8[0]);
+
+	r = frame_alloc(offsetof(struct anycast_rpc, data));
+	r->flag = ANYCAST_RPC_REQ_FLAG;
+	r->address = s->address;
+	r->rpc_id = s->msg_id;
+
+	list_add(rpcs, s);
+	wheel_set(&s->timer, ANYCAST_RPC_TIMEOUT, rpc_expired);
+
+	/* a lost request is covered by the timeout, not by mesh */
+	mesh_tx(s->conn, server);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Called by the timer wheel when a request was not answered
+ * \param t	Pointer to the timer of the send buffer element
+ */
+static void
+rpc_expired(struct wheel_timer *t)
+{
+	struct anycast_send_buffer *s = (struct anycast_send_buffer *)
+		((char *)t - offsetof(struct anycast_send_buffer, timer));
+	struct anycast_conn *c = s->conn;
+	anycast_handle_t handle = s->handle;
+	anycast_addr_t addr = s->address;
+
+	PRINTF("[RPC]\t\tNo reply to request %u.\n", s->msg_id);
+
+	list_remove(rpcs, s);
+	memb_free(&send_buf_mem, s);
+	if(c->cb->timedout) {
+		c->cb->timedout(c, handle, addr, ERR_NO_RESPONSE);
+	}
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Hands the reply of a server to the client application
+ * \param c	A pointer to a struct anycast_conn
+ * \param from	Rime address of the server
+ */
+static void
+rpc_reply_recv(struct anycast_conn *c, const rimeaddr_t *from)
+{
+	struct anycast_rpc *r = (struct anycast_rpc *)packetbuf_dataptr();
+	struct anycast_send_buffer *s;
+	anycast_handle_t handle;
+
+	if(packetbuf_datalen() < offsetof(struct anycast_rpc, data)) {
+		return;
+	}
+
+	for(s = list_head(rpcs); s != NULL; s = s->next) {
+		if(s->conn == c && s->msg_id == r->rpc_id &&
+			s->address == r->address && rimeaddr_cmp(&s->server, from)) {
+			break;
+		}
+	}
+	if(s == NULL) {
+		return;
+	}
+
+	PRINTF("[RPC]\t\tReply to request %u from %02X:%02X (%u bytes)\n",
+		s->msg_id,
+		from->u8[1],
+		from->u8[0],
+		(unsigned)(packetbuf_datalen() - offsetof(struct anycast_rpc, data)));
+
+	handle = s->handle;
+	list_remove(rpcs, s);
+	wheel_stop(&s->timer);
+	memb_free(&send_buf_mem, s);
+	cache_refresh(r->address, from);
+
+	if(c->cb->response) {
+		c->cb->response(c, handle, from, r->address, (char *)r->data,
+			packetbuf_datalen() - offsetof(struct anycast_rpc, data));
+	}
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Delivers a request from a client to the server application
+ * \param c	A pointer to a struct anycast_conn
+ * \param from	Rime address of the client
+ *
+ *		The exchange is kept in the connection while the recv callback
+ *		runs, so that the application can answer with anycast_reply().
+ */
+static void
+rpc_request_recv(struct anycast_conn *c, const rimeaddr_t *from)
+{
+	struct anycast_rpc *r = (struct anycast_rpc *)packetbuf_dataptr();
+
+	if(packetbuf_datalen() < offsetof(struct anycast_rpc, data)) {
+		return;
+	}
+
+	PRINTF("[RPC]\t\tRequest %u (%u bytes) received from %02X:%02X\n",
+		r->rpc_id,
+		(unsigned)(packetbuf_datalen() - offsetof(struct anycast_rpc, data)),
+		from->u8[1],
+		from->u8[0]);
+
+	rimeaddr_copy(&c->rpc_client, from);
+	c->rpc_address = r->address;
+	c->rpc_id = r->rpc_id;
+	c->rpc_open = 1;
+
+	c->cb->recv(c, from, r->address, (char *)r->data,
+		packetbuf_datalen() - offsetof(struct anycast_rpc, data));
+
+	c->rpc_open = 0;
+}
+/*---------------------------------------------------------------------------*/
+static uint8_t bind_lookup(const struct anycast_conn *c,
+	const anycast_addr_t addr);
+/**
+ * \brief	Starts a discovery to bind a session, unless one is in flight
+ * \param s	Pointer to the session
+ */
+static void
+session_discover(struct anycast_session *s)
+{
+	struct anycast_discovery *d;
+
+	if(discovery_pending(s->conn, s->address) != NULL ||
+		unreachable_check(s->address)) {
+		return;
+	}
+
+	d = discovery_new(s->conn, s->address);
+	if(d == NULL) {
+		PRINTF("[ERROR]\t\tDiscovery buffer full!\n");
+		return;
+	}
+	discovery_slots[d->seq_number % ANYCAST_DISCOVERY_SLOTS] = d;
+	discovery_flood(d);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Binds the sessions to an anycast address to the chosen server
+ * \param c	A pointer to a struct anycast_conn
+ * \param addr	Anycast address of the discovery
+ * \param server Rime address of the server chosen by the discovery
+ *
+ *		A bound session keeps its server until session_unbind() finds
+ *		it unreachable, whatever other discoveries for addr choose.
+ */
+static void
+session_bind(struct anycast_conn *c, const anycast_addr_t addr,
+	const rimeaddr_t *server)
+{
+	struct anycast_session *s;
+
+	for(s = list_head(sessions); s != NULL; s = s->next) {
+		if(s->conn == c && s->address == addr && !s->bound) {
+			PRINTF("[SESSION]\tSession to anycast %u bound to %02X:%02X\n",
+				addr,
+				server->u8[1],
+				server->u8[0]);
+
+			rimeaddr_copy(&s->server, server);
+			s->bound = 1;
+			s->missed = 0;
+		}
+	}
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Unbinds the sessions bound to an unreachable server
+ * \param server Rime address of the anycast server
+ *
+ *		This function is called wherever the server is dropped from
+ *		the cache, so that the sessions look for another server at
+ *		once instead of after ANYCAST_KEEPALIVE_MISSES keepalives.
+ */
+static void
+session_unbind(const rimeaddr_t *server)
+{
+	struct anycast_session *s;
+
+	for(s = list_head(sessions); s != NULL; s = s->next) {
+		if(s->bound && rimeaddr_cmp(&s->server, server)) {
+			PRINTF("[SESSION]\tSession to anycast %u unbound from %02X:%02X\n",
+				s->address,
+				server->u8[1],
+				server->u8[0]);
+
+			s->bound = 0;
+			session_discover(s);
+		}
+	}
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Called by the keepalive ctimer of a session
+ * \param ptr	Pointer to the session
+ *
+ *		This function sends a keepalive to the bound server. Once
+ *		ANYCAST_KEEPALIVE_MISSES keepalives in a row went unanswered, the
+ *		session is unbound and a new server is discovered. An unbound
+ *		session tries to bind again every interval.
+ */
+static void
+session_keepalive(void *ptr)
+{
+	struct anycast_session *s = (struct anycast_session *)ptr;
+	struct anycast_keepalive *k;
+
+	ctimer_set(&s->ctimer, ANYCAST_KEEPALIVE_INTERVAL, session_keepalive, s);
+
+	if(s->bound && s->missed >= ANYCAST_KEEPALIVE_MISSES) {
+		PRINTF("[SESSION]\tServer %02X:%02X of anycast %u unreachable, rebinding.\n",
+			s->server.u8[1],
+			s->server.u8[0],
+			s->address);
+		cache_invalidate(&s->server);
+		session_unbind(&s->server);
+	}
+
+	if(!s->bound) {
+		session_discover(s);
+		return;
+	}
+
+	s->missed++;
+	packetbuf_clear();
+	packetbuf_set_datalen(sizeof(struct anycast_keepalive));
+	k = (struct anycast_keepalive *)packetbuf_dataptr();
+	k->flag = ANYCAST_KEEPALIVE_FLAG;
+	k->address = s->address;
+	mesh_tx(s->conn, &s->server);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Handles a keepalive, or the answer to one
+ * \param c	A pointer to a struct anycast_conn
+ * \param from	Rime address of the sender
+ *
+ *		A server answers the keepalive as long as it listens on the
+ *		anycast address. The answer keeps the sessions to the server
+ *		bound.
+ */
+static void
+session_keepalive_recv(struct anycast_conn *c, const rimeaddr_t *from)
+{
+	struct anycast_keepalive k;
+	struct anycast_session *s;
+	rimeaddr_t originator;
+
+	if(packetbuf_datalen() < sizeof(k)) {
+		return;
+	}
+	memcpy(&k, packetbuf_dataptr(), sizeof(k));
+
+	if(k.flag == ANYCAST_KEEPALIVE_FLAG) {
+		if(bind_lookup(c, k.address)) {
+			rimeaddr_copy(&originator, from);
+			k.flag = ANYCAST_KEEPALIVE_ACK_FLAG;
+			packetbuf_copyfrom((char *)&k, sizeof(k));
+			mesh_tx(c, &originator);
+		}
+		return;
+	}
+
+	for(s = list_head(sessions); s != NULL; s = s->next) {
+		if(s->conn == c && s->bound && s->address == k.address &&
+			rimeaddr_cmp(&s->server, from)) {
+			s->missed = 0;
+		}
+	}
+	cache_refresh(k.address, from);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief       Called by the timer wheel to expire an anycast discovery
+ * \param t 	Pointer to the timer of the expired discovery element
+ *
+ *             	This function is called by the timer wheel when no anycast
+ *		server responded to a discovery. A bounded ring is widened
+ *		instead, up to a flood of the whole network. Once that expired,
+ *		every send request queued on the discovery would be removed and
+ *		memory would be freed. Callback on the application timedout
+ *		would be called once for each request with an error code of
+ *		ERR_NO_SERVER_FOUND.
+ */
+static void
+discovery_expired(struct wheel_timer *t)
+{
+	struct anycast_discovery *d = (struct anycast_discovery *)
+		((char *)t - offsetof(struct anycast_discovery, timer));
+	struct anycast_send_buffer *s_buf;
+	anycast_handle_t handle;
+
+	/* no response within the ring, widen it or flood the whole network */
+	if(d->ring != 0) {
+		/* a late response from within the last ring answers it, not the next */
+		d->karn_hops = d->ring;
+		d->ring = (d->ring * 2 > ANYCAST_RING_MAX) ? 0 : d->ring * 2;
+		discovery_flood(d);
+		return;
+	}
+
+	discovery_slots[d->seq_number % ANYCAST_DISCOVERY_SLOTS] = NULL;
+	rtt_backoff(d->address);
+
+	/* fail the next sends to the address locally instead of flooding */
+	unreachable_add(d->address);
+
+	while((s_buf = list_pop(d->requests)) != NULL) {
+		PRINTF("[BUF]\t\tBuffer entry expired: %u|%u|%u bytes\n", 
+			s_buf->seq_number, 
+			s_buf->address,	
+			queuebuf_datalen(s_buf->buf));
+
+		handle = s_buf->handle;
+		queuebuf_free(s_buf->buf);
+		memb_free(&send_buf_mem, s_buf);
+
+	        /* notify application of netflood timed-out. */
+		if(d->conn->cb->timedout) {
+			d->conn->cb->timedout(d->conn, handle, d->address,
+				ERR_NO_SERVER_FOUND);
+		}
+	}
+
+#if ANYCAST_MAX_MSG_LEN > 0
+	if(d->frag) {
+		frag_fail(d->conn, ERR_NO_SERVER_FOUND);
+	}
+#endif
+
+	memb_free(&discovery_mem, d);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Sends every request queued on a discovery to the chosen server
+ * \param d	Pointer to the discovery element
+ *
+ *		This function removes the discovery from the linked-list, sends
+ *		the data of every queued request to the nearest server that
+ *		responded and frees the memory.
+ */
+static void
+discovery_deliver(struct anycast_discovery *d)
+{
+	struct anycast_send_buffer *s_buf;
+
+	discovery_slots[d->seq_number % ANYCAST_DISCOVERY_SLOTS] = NULL;
+	wheel_stop(&d->timer);
+	unreachable_clear(d->address);
+
+#if ANYCAST_CACHE_SIZE > 0
+	cache_update(d->address, &d->server, d->hops, d->load);
+#endif
+
+	PRINTF("[LOG]\t\tChose anycast server %u at %02X:%02X (%u hops, load %u)\n",
+		d->address,
+		d->server.u8[1],
+		d->server.u8[0],
+		d->hops,
+		d->load);
+
+	session_bind(d->conn, d->address, &d->server);
+
+	/* release every request queued on this discovery */
+	while((s_buf = list_pop(d->requests)) != NULL) {
+		/* requests are freed once answered */
+		if(s_buf->rpc) {
+			rpc_start(s_buf, &d->server);
+			continue;
+		}
+
+		/* reliable messages are freed once acknowledged */
+		if(d->conn->reliable) {
+			rdata_start(s_buf, d, &d->server);
+			continue;
+		}
+
+		queuebuf_to_packetbuf(s_buf->buf);
+		queuebuf_free(s_buf->buf);
+
+		data_send(d->conn, s_buf->address, &d->server, s_buf->handle);
+			
+		PRINTF("[BUF]\t\tRemoved %u|%u from send buffer.\n", 
+			s_buf->seq_number, 
+			s_buf->address);
+
+		/* free-up memory */
+		memb_free(&send_buf_mem, s_buf);
+	}
+
+#if ANYCAST_MAX_MSG_LEN > 0
+	/* stream the fragmented message waiting for this server */
+	if(d->frag) {
+		frag_start(d->conn, &d->server);
+	}
+#endif
+
+	memb_free(&discovery_mem, d);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Called by the timer wheel when the collection window closes
+ * \param t	Pointer to the timer of the discovery element
+ */
+static void
+discovery_collected(struct wheel_timer *t)
+{
+	discovery_deliver((struct anycast_discovery *)
+		((char *)t - offsetof(struct anycast_discovery, timer)));
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Handles the response of a server to a discovery of this node
+ * \param res	Pointer to the response
+ * \param hops	Hops between this node and the server
+ *
+ *		This function keeps the cheapest server and the runner-up, and
+ *		sends the queued data once the collection window is over.
+ */
+static void
+res_recv(const struct anycast_res *res, uint8_t hops)
+{
+	struct anycast_discovery *d;
+	uint16_t cost = server_cost(hops, res->load);
+
+	PRINTF("[LOG]\t\tAnycast server %u at %02X:%02X (%u hops, load %u)\n",
+		res->address, 
+		res->server.u8[1], 
+		res->server.u8[0],
+		hops,
+		res->load);
+
+	d = discovery_lookup(res->address, res->seq_number);
+	if(d != NULL && (!d->found || cost < d->cost)) {
+		/* the server replaced becomes the runner-up for failover */
+		if(d->found && !rimeaddr_cmp(&d->server, &res->server)) {
+			rimeaddr_copy(&d->alt, &d->server);
+			d->alt_cost = d->cost;
+			d->has_alt = 1;
+		}
+		/* remember the cheapest server; on equal cost the first wins */
+		rimeaddr_copy(&d->server, &res->server);
+		d->hops = hops;
+		d->load = res->load;
+		d->cost = cost;
+
+		if(!d->found) {
+			d->found = 1;
+			/* Karn: no sample if an earlier ring may have been answered */
+			if(hops > d->karn_hops) {
+				rtt_sample(d->address, clock_time() - d->start, hops);
+			}
+			if(d->window == 0) {
+				discovery_deliver(d);
+			} else {
+				/* wait for other servers to respond */ 
+				wheel_set(&d->timer, d->window, discovery_collected);
+			}
+		}
+	} else if(d != NULL && !rimeaddr_cmp(&d->server, &res->server) &&
+		(!d->has_alt || cost < d->alt_cost)) {
+		/* remember the runner-up for failover in reliable mode */
+		rimeaddr_copy(&d->alt, &res->server);
+		d->alt_cost = cost;
+		d->has_alt = 1;
+	} else {
+		PRINTF("[WARNING]\tRespond from Anycast Server %u[%02x:%02X] ignored (%u hops).\n", 
+			res->address, 
+			res->server.u8[1], 
+			res->server.u8[0],
+			hops);
+	}
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Sends a response back along the reverse path of the flood
+ * \param c	A pointer to a struct anycast_conn
+ * \param res	Pointer to the response
+ *
+ *		The response is passed hop by hop along the routes the flood
+ *		installed toward the client. Every node on the way learns the
+ *		route toward the server in turn, so neither the response nor
+ *		the data that follows waits for a mesh route discovery.
+ *
+ *		Without a route toward the client, only the server sends the
+ *		response over mesh: the route discovery it floods leaves a
+ *		route toward it on every node. A proxy or a node on the way
+ *		drops the response, as the client would not reach the server
+ *		through it, and the client's discovery times out.
+ */
+static void
+res_send(struct anycast_conn *c, struct anycast_res *res)
+{
+	struct route_entry *rt = route_lookup(&res->client);
+
+	if(rt == NULL) {
+		if(!rimeaddr_cmp(&res->server, &rimeaddr_node_addr)) {
+			PRINTF("[ERROR]\t\tNo route to %02X:%02X, response dropped.\n",
+				res->client.u8[1],
+				res->client.u8[0]);
+			return;
+		}
+		packetbuf_copyfrom((char *)res, sizeof(*res));
+		mesh_tx(c, &res->client);
+		return;
+	}
+
+	res->hops++;
+	packetbuf_copyfrom((char *)res, sizeof(*res));
+	unicast_send(&c->fwd_conn, &rt->nexthop);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Drops the pending responses to a discovery another server answered
+ * \param res	Pointer to the response overheard
+ * \param hops	Estimated hops between the client and the other server
+ *
+ *		A pending response is only dropped if the other server costs
+ *		no more than this one, so that the client still learns of a
+ *		better server.
  */
-struct anycast_data {
-	uint8_t flag;
-	anycast_addr_t address;
-	char data[ANYCAST_DATA_LEN];
-};
+static void
+reply_overheard(const struct anycast_res *res, uint8_t hops)
+{
+	struct anycast_reply *r, *next;
 
+	for(r = list_head(replies); r != NULL; r = next) {
+		next = r->next;
+		if(r->res.seq_number == res->seq_number &&
+			r->res.address == res->address &&
+			rimeaddr_cmp(&r->res.client, &res->client) &&
+			!rimeaddr_cmp(&r->res.server, &res->server) &&
+			server_cost(hops, res->load) <=
+			server_cost(r->hops, r->res.load)) {
+			PRINTF("[LOG]\t\tResponse to %02X:%02X suppressed by %02X:%02X\n",
+				res->client.u8[1],
+				res->client.u8[0],
+				res->server.u8[1],
+				res->server.u8[0]);
+
+			ctimer_stop(&r->ctimer);
+			list_remove(replies, r);
+			memb_free(&reply_mem, r);
+		}
+	}
+}
+/*---------------------------------------------------------------------------*/
 /**
- * \brief Data structure for each requests made by application
+ * \brief	Sends a response once its backoff is over
+ * \param ptr	Pointer to the pending response
+ *
+ *		The response is announced to the neighbors first, so that
+ *		other servers waiting to answer the same discovery drop their
+ *		response. In the announcement, hops is the distance of this
+ *		server to the client.
  */
-struct anycast_send_buffer {
-	struct anycast_send_buffer *next;
-	anycast_addr_t address;
-	uint8_t seq_number;
-	char data[ANYCAST_DATA_LEN];
-	struct anycast_conn *conn;
-	struct ctimer ctimer; 
-};
+static void
+reply_timedout(void *ptr)
+{
+	struct anycast_reply *r = (struct anycast_reply *)ptr;
+	struct anycast_conn *c = r->conn;
+	struct anycast_res res;
+
+	memcpy(&res, &r->res, sizeof(res));
+	res.hops = r->hops;
+	list_remove(replies, r);
+	memb_free(&reply_mem, r);
 
+	packetbuf_copyfrom((char *)&res, sizeof(res));
+	broadcast_send(&c->adv_conn);
+
+	res.hops = 0;
+	res_send(c, &res);
+}
+/*---------------------------------------------------------------------------*/
 /**
- * \brief Allocate memory for 5(maximum) anycast address to listen on
+ * \brief	Answers a discovery after a backoff scaled by the distance
+ * \param c	A pointer to a struct anycast_conn
+ * \param res	Pointer to the response
+ * \param hops	Hops between the client and this server
+ *
+ *		Nearer servers answer first, so that farther servers hear
+ *		their response and keep silent. The response is sent right
+ *		away when the backoff is disabled or no memory is left.
  */
-MEMB(anycast_mem, struct anycast_bind_address, 5);
+static void
+reply_schedule(struct anycast_conn *c, struct anycast_res *res,
+	uint8_t hops)
+{
+	struct anycast_reply *r;
 
+	if(ANYCAST_REPLY_BACKOFF == 0 ||
+		(r = memb_alloc(&reply_mem)) == NULL) {
+		res_send(c, res);
+		return;
+	}
+
+	r->conn = c;
+	memcpy(&r->res, res, sizeof(r->res));
+	r->hops = hops;
+	list_add(replies, r);
+	ctimer_set(&r->ctimer, hops * ANYCAST_REPLY_BACKOFF +
+		random_rand() % (ANYCAST_REPLY_BACKOFF + 1), reply_timedout, r);
+}
+/*---------------------------------------------------------------------------*/
 /**
- * \brief Allocate memory for 5(maximum) anycast send request 
+ * \brief	Handles a response passed hop by hop toward its client
+ * \param c	A pointer to a struct anycast_conn
+ * \param from	Rime address of the previous hop
  */
-MEMB(send_buf_mem, struct anycast_send_buffer, 5);
+static void
+res_forward(struct anycast_conn *c, const rimeaddr_t *from)
+{
+	struct anycast_res res;
+	struct route_entry *rt;
+
+	if(packetbuf_datalen() < sizeof(res)) {
+		return;
+	}
+	memcpy(&res, packetbuf_dataptr(), sizeof(res));
 
+	/* the server is reached the way the response came */
+	route_add(&res.server, from, res.hops, 0);
+
+	/* a server waiting to answer the same discovery can keep silent */
+	rt = route_lookup(&res.client);
+	reply_overheard(&res, res.hops + (rt != NULL ? rt->cost : 0));
+
+	if(rimeaddr_cmp(&res.client, &rimeaddr_node_addr)) {
+		res_recv(&res, res.hops);
+		return;
+	}
+
+	if(res.hops >= ANYCAST_MAX_HOPS) {
+		return;
+	}
+
+	PRINTF("[LOG]\t\tForward response of anycast server %u to %02X:%02X\n",
+		res.address,
+		res.client.u8[1],
+		res.client.u8[0]);
+
+	res_send(c, &res);
+}
+/*---------------------------------------------------------------------------*/
 /**
- * \brief Declare linked-list buffer that stores requests made by application
+ * \brief	Tells whether the node listens on an anycast address
+ * \param c	A pointer to a struct anycast_conn
+ * \param addr	Anycast address to look up
+ *
+ *		This function returns non-zero if addr is set in the bind map.
  */
-LIST(send_buf);
-
-/** 
- * \brief sequence number which is incremented for each send request
+static uint8_t
+bind_lookup(const struct anycast_conn *c, const anycast_addr_t addr)
+{
+	return c->bind_map[addr >> 3] & (1 << (addr & 7));
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Updates the admission state of a server
+ * \param c	A pointer to a struct anycast_conn
+ *
+ *		This function starts a new rate period once the current one is
+ *		over and tells whether the server is below both thresholds.
  */
-static uint8_t seq_no = 0;
+static uint8_t
+admission_update(struct anycast_conn *c)
+{
+	struct anycast_admission *a = &c->admission;
 
+	if(clock_time() - a->period_start >= ANYCAST_ADMIT_PERIOD) {
+		a->period_start = clock_time();
+		a->responses = 0;
+	}
+
+	a->admitting = (a->max_load == 0 || c->load < a->max_load) &&
+		(a->max_rate == 0 || a->responses < a->max_rate);
+	return a->admitting;
+}
 /*---------------------------------------------------------------------------*/
 /**
- * \brief	Debug process to print rime address, anycast listening address
- * 		and send buffer content periodically.
+ * \brief	Decides whether a server answers a discovery
+ * \param c	A pointer to a struct anycast_conn
+ * \param addr	Anycast address of the discovery
+ *
+ *		This function counts the response when the discovery is
+ *		admitted. Otherwise the flood is forwarded as if the node did
+ *		not listen on addr, so that the next nearest server answers.
+ *		It is called once per discovery, not for its copies or rings.
  */
-PROCESS(status_process, "Print addresses/requests buffer periodically");
+static uint8_t
+admission_admit(struct anycast_conn *c, const anycast_addr_t addr)
+{
+	if(!admission_update(c)) {
+		c->admission.refused++;
+		PRINTF("[ADMIT]\t\tDiscovery on %u left to other servers (load %u, %u responses).\n",
+			addr,
+			c->load,
+			c->admission.responses);
+		return 0;
+	}
+
+	c->admission.responses++;
+	return 1;
+}
 /*---------------------------------------------------------------------------*/
 /**
- * \brief	Removes and returns buffered anycast send requests
- * \param addr	Anycast address the application sends to
- * \param seq_no Sequence number the anycast request was received
+ * \brief	Looks up a discovery among those served last
+ * \param c	A pointer to a struct anycast_conn
+ * \param originator	Rime address of the client
+ * \param seq	Sequence number of the discovery
  *
- *             This function removes the anycast sent request stored in the 
- *             linked-list buffer and return the pointer to the struct
- *             of the element. Caller of the function is expected to free
- *             the return struct after using. 
+ *		This function returns NULL if the discovery was not served.
  */
-static struct anycast_send_buffer *
-buf_remove(const anycast_addr_t addr, const uint8_t seq_no)
+static struct anycast_served *
+served_lookup(struct anycast_conn *c, const rimeaddr_t *originator,
+	uint8_t seq)
 {
-	struct anycast_send_buffer *s_buf;
+	uint8_t i;
 
-  	for(s_buf = list_head(send_buf); s_buf != NULL; s_buf = s_buf->next ) {
-		if(s_buf->address == addr && s_buf->seq_number == seq_no) {
-			list_remove(send_buf, s_buf);
-			return (struct anycast_send_buffer *) s_buf;
+	for(i = 0; i < ANYCAST_SERVED_NUM; i++) {
+		if(rimeaddr_cmp(&c->served[i].originator, originator) &&
+			c->served[i].seq == seq) {
+			return &c->served[i];
 		}
-  	}
+	}
 	return NULL;
 }
 /*---------------------------------------------------------------------------*/
 /**
- * \brief       Called by the callback timer to expire buffered send request
- * \param n 	Pointer to the expired buffer element
- *
- *             	This function is called by the callback timer when a send
- *             	request has timedout. The send request would be removed from 
- *             	the buffer and memory would be freed. Callback on the 
- *             	on the application timedout would be called with and error 
- *		code of ERR_NO_SERVER_FOUND.
+ * \brief	Remembers a discovery in place of the oldest one served
+ * \param c	A pointer to a struct anycast_conn
+ * \param originator	Rime address of the client
+ * \param seq	Sequence number of the discovery
  */
-static void
-buf_expired(void *n)
+static struct anycast_served *
+served_add(struct anycast_conn *c, const rimeaddr_t *originator,
+	uint8_t seq)
 {
-	struct anycast_send_buffer *s_buf = n;
-	
-	PRINTF("[BUF]\t\tBuffer entry expired: %u|%u|'%s'\n", 
-		s_buf->seq_number, 
-		s_buf->address,	
-		s_buf->data);
-  
-	list_remove(send_buf, s_buf);
-	memb_free(&send_buf_mem, s_buf);
+	struct anycast_served *s = &c->served[c->served_next];
 
-        /* notify application of netflood timed-out. */
-	s_buf->conn->cb->timedout(s_buf->conn, ERR_NO_SERVER_FOUND);
+	c->served_next = (c->served_next + 1) % ANYCAST_SERVED_NUM;
+	rimeaddr_copy(&s->originator, originator);
+	s->seq = seq;
+	s->ring = SERVED_NONE;
+	s->admitted = 0;
+	return s;
 }
 /*---------------------------------------------------------------------------*/
 static int 
 netflood_recv(struct netflood_conn *netflood, const rimeaddr_t * from, 
 	const rimeaddr_t * originator, uint8_t seqno, uint8_t hops)
 {
-	struct anycast_bind_address *s;
 	struct anycast_res res;	
+	struct anycast_req *req = (struct anycast_req *)packetbuf_dataptr();
+#if ANYCAST_CACHE_SIZE > 0
+	struct anycast_server_cache *cache;
+#endif
+	struct anycast_served *s;
+	struct route_entry *rt;
 
-  	uint8_t anycast_addr = *((char *) packetbuf_dataptr());
+  	uint8_t anycast_addr = req->address;
 
 	struct anycast_conn *c = (struct anycast_conn *)
   		((char *)netflood - offsetof(struct anycast_conn, netflood_conn));
 
+	/* the flood walked a path from the originator, keep it as a route back
+	   unless one as short is known, not to push live routes out */
+	rt = route_lookup(originator);
+	if(rt == NULL || rt->cost > hops + 1) {
+		route_add(originator, from, hops + 1, 0);
+	}
+
+	/* admit every discovery once, whatever its copies and rings */
+	s = NULL;
+	if(bind_lookup(c, anycast_addr)) {
+		s = served_lookup(c, originator, req->seq_number);
+		if(s == NULL) {
+			s = served_add(c, originator, req->seq_number);
+			s->admitted = admission_admit(c, anycast_addr);
+		}
+	}
+
 	/* check and serve anycast request */
-	for(s = list_head(c->bind_addrs); s != NULL; s = list_item_next(s)) {
-		if(anycast_addr == (anycast_addr_t)s->address) {
-    			PRINTF("[LOG]\t\tService request on %u. From %02X:%02X, seq %u, hops %u\n",
-				anycast_addr, 
+	if(s != NULL && s->admitted) {
+		/* netflood hands every copy heard to a node that stops the flood */
+		if(s->ring == req->max_hops) {
+			PRINTF("[LOG]\t\tRepeated request from %02X:%02X, seq %u dropped.\n",
+				originator->u8[1],
+				originator->u8[0],
+				req->seq_number);
+			return 0;
+		}
+		s->ring = req->max_hops;
+
+		PRINTF("[LOG]\t\tService request on %u. From %02X:%02X, seq %u, hops %u\n",
+			anycast_addr, 
+			originator->u8[1], 
+			originator->u8[0], 
+			req->seq_number,
+			hops);
+
+		/* eager request, deliver the data and stop the flood */
+		if(req->flag == ANYCAST_EAGER_FLAG) {
+			PRINTF("[LOG]\t\tAnycast data (%u bytes) received from %02X:%02X (eager)\n",
+				(unsigned)(packetbuf_datalen() - offsetof(struct anycast_req, data)),
 				originator->u8[1], 
-				originator->u8[0], 
-				seqno,
-				hops);
-
-			res.flag = 0;
-			res.seq_number = seqno;
-			res.address = anycast_addr;
-			packetbuf_copyfrom((char *)&res, sizeof(res));
-			mesh_send(&c->mesh_conn, originator);
-			
+				originator->u8[0]);
+
+			c->cb->recv(c, originator, anycast_addr, req->data,
+				packetbuf_datalen() - offsetof(struct anycast_req, data));
+
 			FLASH_LED(LEDS_ALL);
 			return 0;
 		}
-  	}
+
+		res.flag = 0;
+		res.seq_number = req->seq_number;
+		res.address = anycast_addr;
+		rimeaddr_copy(&res.server, &rimeaddr_node_addr);
+		res.hops = 0;
+		res.load = c->load;
+		rimeaddr_copy(&res.client, originator);
+		reply_schedule(c, &res, hops + 1);
+		
+		FLASH_LED(LEDS_ALL);
+		return 0;
+	}
+
+#if ANYCAST_CACHE_SIZE > 0
+	/* answer on behalf of a cached server and stop the flood there */
+	cache = cache_lookup(anycast_addr);
+	if(cache != NULL && req->flag != ANYCAST_EAGER_FLAG &&
+		!rimeaddr_cmp(&cache->rime_addr, originator)) {
+		if(s == NULL) {
+			s = served_lookup(c, originator, req->seq_number);
+		}
+		if(s == NULL) {
+			s = served_add(c, originator, req->seq_number);
+		}
+		if(s->ring == req->max_hops) {
+			PRINTF("[LOG]\t\tRepeated request from %02X:%02X, seq %u dropped.\n",
+				originator->u8[1],
+				originator->u8[0],
+				req->seq_number);
+			return 0;
+		}
+		s->ring = req->max_hops;
+
+		PRINTF("[CACHE]\t\tProxy request on %u for %02X:%02X. From %02X:%02X, seq %u\n",
+			anycast_addr,
+			cache->rime_addr.u8[1],
+			cache->rime_addr.u8[0],
+			originator->u8[1], 
+			originator->u8[0], 
+			req->seq_number);
+
+		res.flag = 0;
+		res.seq_number = req->seq_number;
+		res.address = anycast_addr;
+		rimeaddr_copy(&res.server, &cache->rime_addr);
+		res.hops = cache->hops;
+		res.load = cache->load;
+		rimeaddr_copy(&res.client, originator);
+		/* passed hop by hop, so that every node on the way learns the
+		   route toward the server through the proxy */
+		res_send(c, &res);
+
+		FLASH_LED(LEDS_ALL);
+		return 0;
+	}
+#endif
+
+	/* stop at the edge of the current ring */
+	if(req->max_hops != 0 && hops + 1 >= req->max_hops) {
+		PRINTF("[LOG]\t\tDrop anycast request from %02X:%02X at ring edge (%u hops)\n",
+			originator->u8[1],
+			originator->u8[0], 
+			hops + 1);
+		return 0;
+	}
 
 	/* forward anycast request message */
 	PRINTF("[LOG]\t\tForward anycast request from %02X:%02X to anycast %u\n",
@@ -214,16 +2912,45 @@ static void
 mesh_sent(struct mesh_conn *c)
 {
 	struct anycast_data *a_data;
+	struct anycast_batch *b;
+	anycast_handle_t handles[ANYCAST_BATCH_RECORDS];
+	uint16_t len, i;
+	uint8_t n, count;
 	uint8_t flag = (uint8_t) *((char *)packetbuf_dataptr());
 	struct anycast_conn *a_conn = (struct anycast_conn *)
 		((char *)c - offsetof(struct anycast_conn, mesh_conn));
+	const rimeaddr_t *server;
+
+	/* the frame is sent right away, or mesh found a route for its queue */
+	if(a_conn->tx_busy) {
+		count = a_conn->tx_count;
+		memcpy(handles, a_conn->tx_handles, count * sizeof(anycast_handle_t));
+		server = &a_conn->tx_server;
+	} else {
+		count = a_conn->queued_count;
+		memcpy(handles, a_conn->queued_handles,
+			count * sizeof(anycast_handle_t));
+		a_conn->queued_count = 0;
+		server = &a_conn->queued_server;
+	}
 
 	/* only callback to application for sending of data and not response */
-	if(flag == 1) {
+	if(flag == ANYCAST_DATA_FLAG && count > 0) {
 		a_data = (struct anycast_data *)packetbuf_dataptr();
+		cache_refresh(a_data->address, server);
 		if(a_conn->cb->sent) {
-    			a_conn->cb->sent(a_conn, a_data->address, a_data->data);
+    			a_conn->cb->sent(a_conn, handles[0], a_data->address,
+				a_data->data, a_data->len);
   		}
+	} else if(flag == ANYCAST_BATCH_FLAG && a_conn->cb->sent) {
+		b = (struct anycast_batch *)packetbuf_dataptr();
+		len = packetbuf_datalen() - offsetof(struct anycast_batch, data);
+		cache_refresh(b->address, server);
+		for(i = 0, n = 0; n < b->count && n < count && i < len; n++) {
+			a_conn->cb->sent(a_conn, handles[n], b->address,
+				(char *)b->data + i + 1, b->data[i]);
+			i += 1 + b->data[i];
+		}
 	}
 }
 /*---------------------------------------------------------------------------*/
@@ -232,82 +2959,443 @@ mesh_timedout(struct mesh_conn *c)
 {
 	struct anycast_conn *a_conn = (struct anycast_conn *)
 		((char *)c - offsetof(struct anycast_conn, mesh_conn));
+	uint8_t count = a_conn->queued_count;
 	
   	PRINTF("[LOG]\t\tMesh packet timedout.\n");
 
-	/* notify application of mesh packet timed-out. */
-	if(a_conn->cb->timedout) {
-		a_conn->cb->timedout(a_conn, ERR_NO_ROUTE);	
+	/* a lost fragment, response or reliable message carries no handle */
+	a_conn->queued_count = 0;
+
+	/* mesh found no route to the server, stop sending it cached data */
+	cache_invalidate(&a_conn->queued_server);
+	session_unbind(&a_conn->queued_server);
+
+	/* notify application of mesh packet timed-out. */
+	handles_timedout(a_conn, a_conn->queued_handles, count,
+		a_conn->queued_address, ERR_NO_ROUTE);
+}
+/*---------------------------------------------------------------------------*/
+static void 
+mesh_recv(struct mesh_conn *c, const rimeaddr_t *from, uint8_t hops)
+{
+	/* get first byte to determine whether it's a RES or DATA */
+	uint8_t flag = (uint8_t) *((char *)packetbuf_dataptr());
+	
+	if(flag == ANYCAST_RES_FLAG){		/* response from anycast nodes */
+		struct anycast_res *res = (struct anycast_res *)packetbuf_dataptr();
+
+		/* only the server sends its response over mesh */
+		res_recv(res, hops);
+	} else if (flag == ANYCAST_DATA_FLAG) {		/* received data from client */
+		struct anycast_data *a_data = (struct anycast_data *)packetbuf_dataptr();
+		struct anycast_conn *a_conn = (struct anycast_conn *)
+    			((char *)c - offsetof(struct anycast_conn, mesh_conn));
+
+		/* drop data frames shorter than their announced length */
+		if(a_data->len > ANYCAST_DATA_LEN ||
+			packetbuf_datalen() < offsetof(struct anycast_data, data) + a_data->len) {
+			PRINTF("[ERROR]\t\tMalformed anycast data from %02X:%02X dropped.\n",
+				from->u8[1],
+				from->u8[0]);
+			return;
+		}
+		
+		PRINTF("[LOG]\t\tAnycast data (%u bytes) received from %02X:%02X (%u hops)\n",
+			a_data->len,
+			from->u8[1], 
+			from->u8[0],
+			hops);
+
+		/* notify application of data received */
+		a_conn->cb->recv(a_conn, from, a_data->address, a_data->data,
+			a_data->len);
+	} else if (flag == ANYCAST_RDATA_FLAG) {	/* data to acknowledge */
+		rdata_recv((struct anycast_conn *)
+			((char *)c - offsetof(struct anycast_conn, mesh_conn)), from);
+	} else if (flag == ANYCAST_RPC_REQ_FLAG) {	/* request to answer */
+		rpc_request_recv((struct anycast_conn *)
+			((char *)c - offsetof(struct anycast_conn, mesh_conn)), from);
+	} else if (flag == ANYCAST_RPC_REP_FLAG) {	/* reply to a request */
+		rpc_reply_recv((struct anycast_conn *)
+			((char *)c - offsetof(struct anycast_conn, mesh_conn)), from);
+	} else if (flag == ANYCAST_KEEPALIVE_FLAG ||
+		flag == ANYCAST_KEEPALIVE_ACK_FLAG) {	/* session liveness */
+		session_keepalive_recv((struct anycast_conn *)
+			((char *)c - offsetof(struct anycast_conn, mesh_conn)), from);
+	} else if (flag == ANYCAST_ACK_FLAG) {		/* reliable data acknowledged */
+		rdata_ack_recv((struct anycast_conn *)
+			((char *)c - offsetof(struct anycast_conn, mesh_conn)), from);
+	} else if (flag == ANYCAST_BATCH_FLAG) {	/* several records from a client */
+		batch_recv((struct anycast_conn *)
+			((char *)c - offsetof(struct anycast_conn, mesh_conn)), from);
+#if ANYCAST_MAX_MSG_LEN > 0
+	} else if (flag == ANYCAST_FRAG_FLAG) {		/* fragment of a large message */
+		frag_recv((struct anycast_conn *)
+			((char *)c - offsetof(struct anycast_conn, mesh_conn)), from);
+	} else if (flag == ANYCAST_FRAG_ACK_FLAG) {	/* fragments acknowledged */
+		frag_ack_recv((struct anycast_conn *)
+			((char *)c - offsetof(struct anycast_conn, mesh_conn)), from);
+#endif
+	} 
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Returns the gradient toward the nearest server of an address
+ * \param addr	Anycast address to look up
+ *
+ *		This function returns NULL if no server has been advertised
+ *		for addr.
+ */
+static struct anycast_gradient *
+gradient_lookup(const anycast_addr_t addr)
+{
+	struct anycast_gradient *g;
+
+	for(g = list_head(gradients); g != NULL; g = g->next) {
+		if(g->address == addr) {
+			return g;
+		}
+	}
+	return NULL;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Broadcasts the anycast addresses this node can reach
+ * \param c	A pointer to a struct anycast_conn
+ *
+ *		This function advertises the anycast addresses the node listens
+ *		on with 0 hops, followed by the gradients it has learned. Every
+ *		gradient names its next hop, which takes it as unreachable.
+ */
+static void
+adv_send(struct anycast_conn *c)
+{
+	struct anycast_adv adv;
+	struct anycast_gradient *g;
+	uint16_t a;
+
+	adv.flag = ANYCAST_ADV_FLAG;
+	adv.count = 0;
+
+	for(a = 0; a < 256 && adv.count < ANYCAST_ADV_ENTRIES; a++) {
+		if(bind_lookup(c, a)) {
+			adv.entries[adv.count].address = a;
+			adv.entries[adv.count].hops = 0;
+			rimeaddr_copy(&adv.entries[adv.count].nexthop,
+				&rimeaddr_node_addr);
+			adv.count++;
+		}
+	}
+
+	for(g = list_head(gradients); g != NULL && 
+		adv.count < ANYCAST_ADV_ENTRIES; g = g->next) {
+		if(g->conn == c && !bind_lookup(c, g->address)) {
+			adv.entries[adv.count].address = g->address;
+			adv.entries[adv.count].hops = g->hops;
+			rimeaddr_copy(&adv.entries[adv.count].nexthop, &g->nexthop);
+			adv.count++;
+		}
+	}
+
+	PRINTF("[GRAD]\t\tAdvertising %u anycast addresses.\n", adv.count);
+
+	packetbuf_copyfrom((char *)&adv, offsetof(struct anycast_adv, entries) +
+		adv.count * sizeof(struct anycast_adv_entry));
+	broadcast_send(&c->adv_conn);
+}
+/*---------------------------------------------------------------------------*/
+static void adv_interval_start(struct anycast_conn *c);
+/**
+ * \brief	Called by the callback timer at the end of a Trickle interval
+ * \param ptr	Pointer to the anycast connection
+ *
+ *		This function doubles the advertisement interval up to its
+ *		maximum and starts the next interval.
+ */
+static void
+adv_interval_end(void *ptr)
+{
+	struct anycast_conn *c = ptr;
+
+	if(c->adv_interval < ANYCAST_ADV_IMAX) {
+		c->adv_interval *= 2;
+	}
+	adv_interval_start(c);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Called by the callback timer at the transmission time of a
+ *		Trickle interval
+ * \param ptr	Pointer to the anycast connection
+ *
+ *		This function advertises unless enough consistent advertisements
+ *		have been heard during the interval.
+ */
+static void
+adv_fire(void *ptr)
+{
+	struct anycast_conn *c = ptr;
+
+	if(c->adv_counter < ANYCAST_ADV_REDUNDANCY) {
+		adv_send(c);
+	} else {
+		PRINTF("[GRAD]\t\tAdvertisement suppressed.\n");
+	}
+	ctimer_set(&c->adv_ctimer, c->adv_remaining, adv_interval_end, c);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Starts a Trickle interval
+ * \param c	A pointer to a struct anycast_conn
+ *
+ *		This function picks the transmission time at random in the
+ *		second half of the interval.
+ */
+static void
+adv_interval_start(struct anycast_conn *c)
+{
+	clock_time_t t;
+
+	t = c->adv_interval / 2 + random_rand() % (c->adv_interval / 2);
+	c->adv_counter = 0;
+	c->adv_remaining = c->adv_interval - t;
+	ctimer_set(&c->adv_ctimer, t, adv_fire, c);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Resets the Trickle interval after the gradients changed
+ * \param c	A pointer to a struct anycast_conn
+ */
+static void
+adv_reset(struct anycast_conn *c)
+{
+	if(c->proactive && c->adv_interval != ANYCAST_ADV_IMIN) {
+		c->adv_interval = ANYCAST_ADV_IMIN;
+		adv_interval_start(c);
+	}
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Removes a gradient and frees its memory
+ * \param g	Pointer to the gradient element
+ */
+static void
+gradient_remove(struct anycast_gradient *g)
+{
+	PRINTF("[GRAD]\t\tGradient removed -> %u via %02X:%02X\n",
+		g->address,
+		g->nexthop.u8[1],
+		g->nexthop.u8[0]);
+
+	wheel_stop(&g->timer);
+	list_remove(gradients, g);
+	memb_free(&gradient_mem, g);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Called by the timer wheel when a gradient was not refreshed
+ * \param t	Pointer to the timer of the expired gradient element
+ */
+static void
+expire_gradient(struct wheel_timer *t)
+{
+	struct anycast_gradient *g = (struct anycast_gradient *)
+		((char *)t - offsetof(struct anycast_gradient, timer));
+	struct anycast_conn *c = g->conn;
+
+	gradient_remove(g);
+	adv_reset(c);
+}
+/*---------------------------------------------------------------------------*/
+static void
+adv_recv(struct broadcast_conn *b, const rimeaddr_t *sender)
+{
+	struct anycast_adv *adv = (struct anycast_adv *)packetbuf_dataptr();
+	struct anycast_adv_entry *e;
+	struct anycast_gradient *g;
+	uint8_t i, hops, changed = 0;
+	struct anycast_conn *c = (struct anycast_conn *)
+		((char *)b - offsetof(struct anycast_conn, adv_conn));
+
+	/* response announced by a server nearby */
+	if(adv->flag == ANYCAST_RES_FLAG) {
+		if(packetbuf_datalen() >= sizeof(struct anycast_res)) {
+			reply_overheard((struct anycast_res *)adv,
+				((struct anycast_res *)adv)->hops);
+		}
+		return;
+	}
+
+	if(!c->proactive || adv->flag != ANYCAST_ADV_FLAG ||
+		packetbuf_datalen() < offsetof(struct anycast_adv, entries) ||
+		adv->count > ANYCAST_ADV_ENTRIES ||
+		packetbuf_datalen() < offsetof(struct anycast_adv, entries) +
+		adv->count * sizeof(struct anycast_adv_entry)) {
+		return;
+	}
+
+	for(i = 0; i < adv->count; i++) {
+		e = &adv->entries[i];
+		/* poisoned reverse, a gradient through this node is no way back */
+		if(e->hops >= ANYCAST_MAX_HOPS - 1 ||
+			rimeaddr_cmp(&e->nexthop, &rimeaddr_node_addr)) {
+			hops = ANYCAST_MAX_HOPS;
+		} else {
+			hops = e->hops + 1;
+		}
+
+		if(bind_lookup(c, e->address)) {
+			continue;
+		}
+
+		g = gradient_lookup(e->address);
+		if(g == NULL) {
+			if(hops >= ANYCAST_MAX_HOPS) {
+				continue;
+			}
+			g = memb_alloc(&gradient_mem);
+			if(g == NULL) {
+				continue;
+			}
+			g->address = e->address;
+			g->conn = c;
+			list_add(gradients, g);
+		} else if(rimeaddr_cmp(&g->nexthop, sender)) {
+			/* the next hop moved away from the server */
+			if(hops >= ANYCAST_MAX_HOPS) {
+				gradient_remove(g);
+				changed = 1;
+				continue;
+			}
+			if(g->hops != hops) {
+				g->hops = hops;
+				changed = 1;
+			}
+			wheel_set(&g->timer, ANYCAST_GRADIENT_LIFETIME, expire_gradient);
+			continue;
+		} else if(hops >= g->hops) {
+			continue;
+		}
+
+		/* new or shorter gradient toward the server */
+		rimeaddr_copy(&g->nexthop, sender);
+		g->hops = hops;
+		wheel_set(&g->timer, ANYCAST_GRADIENT_LIFETIME, expire_gradient);
+		changed = 1;
+
+		PRINTF("[GRAD]\t\tGradient %u via %02X:%02X (%u hops)\n",
+			g->address,
+			g->nexthop.u8[1],
+			g->nexthop.u8[0],
+			g->hops);
+	}
+
+	if(changed) {
+		adv_reset(c);
+	} else {
+		c->adv_counter++;
+	}
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Sends data along the gradient toward the nearest server
+ * \param c	The anycast connection on which the data should be sent
+ * \param g	Pointer to the gradient of the anycast address
+ * \param handle Handle of the packet
+ *
+ *		This function frames the data in the packetbuf as a forward
+ *		message and sends it to the next hop of the gradient.
+ */
+static void
+gradient_send(struct anycast_conn *c, const struct anycast_gradient *g,
+	anycast_handle_t handle)
+{
+	struct anycast_fwd *fwd;
+	uint16_t len = packetbuf_datalen();
+
+	fwd = frame_alloc(offsetof(struct anycast_fwd, data));
+	fwd->flag = ANYCAST_FWD_FLAG;
+	fwd->address = g->address;
+	fwd->ttl = ANYCAST_MAX_HOPS;
+	rimeaddr_copy(&fwd->originator, &rimeaddr_node_addr);
+
+	PRINTF("[GRAD]\t\tSending data (%u bytes) to anycast %u via %02X:%02X (%u hops)\n",
+		len,
+		g->address,
+		g->nexthop.u8[1],
+		g->nexthop.u8[0],
+		g->hops);
+
+	if(!unicast_send(&c->fwd_conn, &g->nexthop)) {
+		PRINTF("[ERROR]\t\tGradient send failed!\n");
+		if(c->cb->timedout) {
+			c->cb->timedout(c, handle, g->address, ERR_NO_ROUTE);
+		}
+		return;
+	}
+
+	if(c->cb->sent) {
+		c->cb->sent(c, handle, g->address, fwd->data, len);
 	}
 }
 /*---------------------------------------------------------------------------*/
-static void 
-mesh_recv(struct mesh_conn *c, const rimeaddr_t *from, uint8_t hops)
+static void
+fwd_recv(struct unicast_conn *u, const rimeaddr_t *from)
 {
-	/* get first byte to determine whether it's a RES or DATA */
-	uint8_t flag = (uint8_t) *((char *)packetbuf_dataptr());
-	
-	if(flag == ANYCAST_RES_FLAG){		/* response from anycast nodes */
-		struct anycast_res *res = (struct anycast_res *)packetbuf_dataptr();
-		struct anycast_send_buffer *s_buf;
-		struct anycast_data a_data;
-		
-		PRINTF("[LOG]\t\tAnycast server %u at %02X:%02X (%u hops)\n",
-			res->address, 
-			from->u8[1], 
-			from->u8[0],
-			hops);
-	
-		s_buf = buf_remove(res->address, res->seq_number);
-		if(s_buf != NULL) {
-			PRINTF("[LOG]\t\tSending data '%s'...\n", 
-				s_buf->data);
-			
-			a_data.flag = 1;
-			a_data.address = s_buf->address;
-			snprintf(a_data.data, sizeof(s_buf->data), "%s", s_buf->data);
+	struct anycast_fwd *fwd = (struct anycast_fwd *)packetbuf_dataptr();
+	struct anycast_gradient *g;
+	struct anycast_conn *c = (struct anycast_conn *)
+		((char *)u - offsetof(struct anycast_conn, fwd_conn));
 
-			packetbuf_copyfrom((char *)&a_data, sizeof(a_data));
-			mesh_send(c ,from);
-			
-			PRINTF("[BUF]\t\tRemoved %u|%u|'%s' from send buffer.\n", 
-				s_buf->seq_number, 
-				s_buf->address, 
-				s_buf->data);
-			
-			/* stop call backtimer since data has already been sent */ 
-			ctimer_stop(&s_buf->ctimer);
+	if(fwd->flag == ANYCAST_RES_FLAG) {
+		res_forward(c, from);
+		return;
+	}
 
-			/* free-up memory */
-			memb_free(&send_buf_mem, s_buf);
+	if(fwd->flag != ANYCAST_FWD_FLAG ||
+		packetbuf_datalen() < offsetof(struct anycast_fwd, data)) {
+		return;
+	}
 
-		} else {
-			PRINTF("[WARNING]\tRespond from Anycast Server %u[%02x:%02X] ignored (%u hops).\n", 
-				res->address, 
-				from->u8[1], 
-				from->u8[0],
-				hops);
-		}
-	} else if (flag == ANYCAST_DATA_FLAG) {		/* received data from client */
-		struct anycast_data *a_data = (struct anycast_data *)packetbuf_dataptr();
-		struct anycast_conn *a_conn = (struct anycast_conn *)
-    			((char *)c - offsetof(struct anycast_conn, mesh_conn));
-		
-		PRINTF("[LOG]\t\tAnycast data '%s' received from %02X:%02X (%u hops)\n",
-			a_data->data,
-			from->u8[1], 
-			from->u8[0],
-			hops);
+	/* deliver data sent to an anycast address this node listens on */
+	if(bind_lookup(c, fwd->address)) {
+		PRINTF("[LOG]\t\tAnycast data (%u bytes) received from %02X:%02X (gradient)\n",
+			(unsigned)(packetbuf_datalen() - offsetof(struct anycast_fwd, data)),
+			fwd->originator.u8[1], 
+			fwd->originator.u8[0]);
 
-		/* notify application of data received */
-		a_conn->cb->recv(a_conn, from, a_data->address, a_data->data);
-	} 
+		c->cb->recv(c, &fwd->originator, fwd->address, fwd->data,
+			packetbuf_datalen() - offsetof(struct anycast_fwd, data));
+		FLASH_LED(LEDS_ALL);
+		return;
+	}
+
+	/* forward down the gradient, never back to the previous hop */
+	g = gradient_lookup(fwd->address);
+	if(g == NULL || fwd->ttl == 0 || rimeaddr_cmp(&g->nexthop, from)) {
+		PRINTF("[WARNING]\tNo gradient toward anycast %u, data from %02X:%02X dropped.\n",
+			fwd->address,
+			fwd->originator.u8[1], 
+			fwd->originator.u8[0]);
+		return;
+	}
+
+	PRINTF("[GRAD]\t\tForward data to anycast %u via %02X:%02X\n",
+		fwd->address,
+		g->nexthop.u8[1],
+		g->nexthop.u8[0]);
+
+	fwd->ttl--;
+	unicast_send(&c->fwd_conn, &g->nexthop);
+	FLASH_LED(LEDS_BLUE);
 }
 /*---------------------------------------------------------------------------*/
 static const struct netflood_callbacks netflood_call = 
 			{ netflood_recv, netflood_sent, netflood_dropped };
 static const struct mesh_callbacks mesh_call = 
 			{ mesh_recv, mesh_sent, mesh_timedout };
+static const struct broadcast_callbacks adv_call = { adv_recv };
+static const struct unicast_callbacks fwd_call = { fwd_recv };
 /*---------------------------------------------------------------------------*/
 void 
 anycast_open(struct anycast_conn *c, uint16_t channels,	
@@ -318,13 +3406,53 @@ anycast_open(struct anycast_conn *c, uint16_t channels,
 	
 	/* opens mesh connection for sending respond or data */
 	mesh_open(&c->mesh_conn, channels+1, &mesh_call);
+
+	/* opens broadcast and unicast connections for the proactive mode */
+	broadcast_open(&c->adv_conn, channels+4, &adv_call);
+	unicast_open(&c->fwd_conn, channels+5, &fwd_call);
   
 	c->cb = callbacks;
+	c->eager = 0;
+	c->collect_window = 0;
+	c->proactive = 0;
+#if ANYCAST_MAX_MSG_LEN > 0
+	c->frag_data = NULL;
+#endif
+	c->tx_count = 0;
+	c->tx_busy = 0;
+	c->queued_count = 0;
+	c->reliable = 0;
+	c->load = 0;
+	c->rpc_open = 0;
+	memset(c->served, 0, sizeof(c->served));
+	c->served_next = 0;
+	memset(&c->admission, 0, sizeof(c->admission));
+	c->admission.period_start = clock_time();
+	c->admission.admitting = 1;
+	c->batch_delay = 0;
+	c->batch_count = 0;
+	c->batch_len = 0;
 	
-	/* initialize and allocate memory for lists */
-	LIST_STRUCT_INIT(c, bind_addrs);
-	memb_init(&anycast_mem);
+	memset(c->bind_map, 0, sizeof(c->bind_map));
+
+	/* the pools are shared by every connection, initialize them once */
+	if(pools_ready) {
+		return;
+	}
+	pools_ready = 1;
 	memb_init(&send_buf_mem);
+	memb_init(&discovery_mem);
+	memb_init(&gradient_mem);
+	memb_init(&reply_mem);
+#if ANYCAST_RTT_NUM > 0
+	memb_init(&rtt_mem);
+#endif
+#if ANYCAST_UNREACHABLE_NUM > 0
+	memb_init(&unreachable_mem);
+#endif
+#if ANYCAST_CACHE_SIZE > 0
+	memb_init(&anycast_cache_mem);
+#endif
 	
 	/* process for printing rime address, anycast address and send buffer */
 	if(DEBUG) {
@@ -332,84 +3460,622 @@ anycast_open(struct anycast_conn *c, uint16_t channels,
 	}
 }
 /*---------------------------------------------------------------------------*/
+void 
+anycast_open_proactive(struct anycast_conn *c, uint16_t channels,	
+	const struct anycast_callbacks *callbacks)
+{
+	anycast_open(c, channels, callbacks);
+
+	/* starts advertising with the minimum Trickle interval */
+	c->proactive = 1;
+	c->adv_interval = ANYCAST_ADV_IMIN;
+	adv_interval_start(c);
+}
+/*---------------------------------------------------------------------------*/
 int 
 anycast_listen_on(struct anycast_conn *c, const anycast_addr_t anycast_addr)
 {
-	static struct anycast_bind_address *bind_addr;
-
-	bind_addr = memb_alloc(&anycast_mem);
-  	if(bind_addr != NULL) {	
-		bind_addr->address = anycast_addr;
-		list_add(c->bind_addrs, bind_addr);
+	c->bind_map[anycast_addr >> 3] |= 1 << (anycast_addr & 7);
 		
-		PRINTF("[LOG]\t\tBinded anycast addr %u \n", 
-			bind_addr->address);
+	PRINTF("[LOG]\t\tBinded anycast addr %u \n", anycast_addr);
+
+	/* advertise the new anycast address quickly */
+	adv_reset(c);
 		
-		return 0;
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
+void 
+anycast_set_eager(struct anycast_conn *c, uint8_t on)
+{
+	c->eager = on;
+}
+/*---------------------------------------------------------------------------*/
+void 
+anycast_set_collect_window(struct anycast_conn *c, clock_time_t window)
+{
+	c->collect_window = window;
+}
+/*---------------------------------------------------------------------------*/
+void 
+anycast_set_load(struct anycast_conn *c, uint8_t load)
+{
+	c->load = load;
+}
+/*---------------------------------------------------------------------------*/
+void 
+anycast_set_admission(struct anycast_conn *c, uint8_t max_load,
+	uint8_t max_rate)
+{
+	c->admission.max_load = max_load;
+	c->admission.max_rate = max_rate;
+	admission_update(c);
+}
+/*---------------------------------------------------------------------------*/
+const struct anycast_admission *
+anycast_admission(struct anycast_conn *c)
+{
+	admission_update(c);
+	return &c->admission;
+}
+/*---------------------------------------------------------------------------*/
+void 
+anycast_set_reliable(struct anycast_conn *c, uint8_t on)
+{
+	c->reliable = on;
+}
+/*---------------------------------------------------------------------------*/
+void 
+anycast_set_batching(struct anycast_conn *c, clock_time_t delay,
+	uint8_t threshold)
+{
+	c->batch_delay = delay;
+	c->batch_threshold = threshold;
+
+	/* records batched so far are not held back any longer */
+	if(delay == 0) {
+		batch_flush(c);
+	}
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief	Floods data to the nearest anycast servers in eager mode
+ * \param c	The anycast connection on which the data should be sent
+ * \param dest	The anycast address the data should be sent to
+ * \param handle Handle of the packet
+ *
+ *             This function frames the data in the packetbuf as a netflood
+ *             request, so that the servers reached deliver it without
+ *             answering with a response.
+ */
+static void
+eager_send(struct anycast_conn *c, const anycast_addr_t dest,
+	anycast_handle_t handle)
+{
+	struct anycast_req *req;
+	uint16_t len = packetbuf_datalen();
+
+	req = frame_alloc(offsetof(struct anycast_req, data));
+	req->address = dest;
+	req->flag = ANYCAST_EAGER_FLAG;
+	req->seq_number = seq_no;
+	req->max_hops = 0;
+
+	PRINTF("[LOG]\t\tEager anycast send. seq:%u|svr:%u|%u bytes\n",
+		seq_no,
+		dest,
+		len);
+
+	if(netflood_send(&c->netflood_conn, seq_no++)) {
+		if(c->cb->sent) {
+			c->cb->sent(c, handle, dest, req->data, len);
+		}
+	} else {
+		PRINTF("[ERROR]\t\tEager netflood failed!\n");
+		if(c->cb->timedout) {
+			c->cb->timedout(c, handle, dest, ERR_NO_SERVER_FOUND);
+		}
+	}
+}
+/*---------------------------------------------------------------------------*/
+#if ANYCAST_CACHE_SIZE > 0
+/**
+ * \brief	Sends the packet in the packetbuf to a cached server
+ * \param c	The anycast connection on which the packet should be sent
+ * \param cache	Pointer to the cache element of the anycast address
+ * \param handle Handle of the packet
+ * \param rpc	Non-zero to send the packet as a request
+ *
+ *		The packet goes straight to the server, without a discovery.
+ */
+static int
+cache_send(struct anycast_conn *c, const struct anycast_server_cache *cache,
+	anycast_handle_t handle, uint8_t rpc)
+{
+	struct anycast_send_buffer *s_buf;
+
+	PRINTF("[CACHE]\t\tAnycast address in cache. %u(%02x:%02X)\n",
+		cache->anycast_addr,
+		cache->rime_addr.u8[1],
+		cache->rime_addr.u8[0]);
+
+	if(!c->reliable && !rpc) {
+		data_send(c, cache->anycast_addr, &cache->rime_addr, handle);
+		return handle;
+	}
+
+	s_buf = memb_alloc(&send_buf_mem);
+	if(s_buf == NULL) {
+		PRINTF("[ERROR]\t\tSend buffer full!\n");
+		return ANYCAST_ERR_FULL;
+	}
+	s_buf->buf = queuebuf_new_from_packetbuf();
+	if(s_buf->buf == NULL) {
+		PRINTF("[ERROR]\t\tNo queuebuf for anycast data!\n");
+		memb_free(&send_buf_mem, s_buf);
+		return ANYCAST_ERR_FULL;
 	}
+	s_buf->address = cache->anycast_addr;
+	s_buf->conn = c;
+	s_buf->handle = handle;
+	s_buf->rpc = rpc;
+	s_buf->msg_id = c->rdata_id++;
+	s_buf->rediscovered = 0;
 
-	return -1;
+	if(rpc) {
+		rpc_start(s_buf, &cache->rime_addr);
+	} else {
+		rdata_start(s_buf, NULL, &cache->rime_addr);
+	}
+	return handle;
 }
+#endif /* ANYCAST_CACHE_SIZE > 0 */
 /*---------------------------------------------------------------------------*/
-void 
-anycast_send(struct anycast_conn *c, const anycast_addr_t dest)
+/**
+ * \brief	Sends the packet in the packetbuf to an anycast address
+ * \param c	The anycast connection on which the packet should be sent
+ * \param dest	The anycast address the packet should be sent to
+ * \param rpc	Non-zero to send the packet as a request
+ *
+ *		This function implements anycast_send() and anycast_request().
+ */
+static int
+send_packet(struct anycast_conn *c, const anycast_addr_t dest, uint8_t rpc)
 {
 	static struct anycast_send_buffer *s_buf;
-	char addr_buf[2];
+	static struct anycast_discovery *d;
+	static struct anycast_gradient *g;
+	anycast_handle_t handle;
+	uint8_t new_discovery = 0;
+#if ANYCAST_CACHE_SIZE > 0
+	struct anycast_server_cache *cache;
+#endif
 
 	 /* checks whether data to be sent conforms to size limit */
         if(packetbuf_datalen() > ANYCAST_DATA_LEN) {
                 PRINTF("[ERROR]\t\tData length out of range.");
-                return;
+                return ANYCAST_ERR_INVALID;
         }
 
 	/* checks whether anycast address is valid */
         if(dest<0 || dest>255) {
                 PRINTF("[ERROR]\t\tAnycast address out of range.\n");
-                return;
+                return ANYCAST_ERR_INVALID;
         }
 
+	handle = handle_new();
+
+#if ANYCAST_CACHE_SIZE > 0
+	/* a cached server needs no discovery */
+	cache = cache_lookup(dest);
+	if(cache != NULL) {
+		return cache_send(c, cache, handle, rpc);
+	}
+#endif
+
+	/* follow the gradient toward the nearest server in proactive mode */
+	g = gradient_lookup(dest);
+	if(!c->reliable && !rpc && c->proactive && g != NULL) {
+		gradient_send(c, g, handle);
+		return handle;
+	}
+
+	/* no server was found lately, do not flood again */
+	if(unreachable_check(dest)) {
+		return ANYCAST_ERR_UNREACHABLE;
+	}
+
+	/* small data rides on the discovery flood itself in eager mode */
+	if(!c->reliable && !rpc && c->eager &&
+		packetbuf_datalen() <= ANYCAST_EAGER_LEN) {
+		eager_send(c, dest, handle);
+		return handle;
+	}
+
 	s_buf = memb_alloc(&send_buf_mem);
-	if(s_buf != NULL) {
-		/* store data in buf first */
-		s_buf->address = dest;
-		s_buf->seq_number = seq_no++;
-		s_buf->conn = c;
-		snprintf(s_buf->data, packetbuf_datalen(), "%s", (char *)packetbuf_dataptr());
-			
-		PRINTF("[LOG]\t\tReceived anycast send. seq:%u|svr:%u|data:'%s'\n",
-			s_buf->seq_number, 
-			s_buf->address, 
-			s_buf->data);
+	if(s_buf == NULL) {
+		PRINTF("[ERROR]\t\tSend buffer full!\n");
+		return ANYCAST_ERR_FULL;
+	}
 
-		list_add(send_buf, s_buf);
-		ctimer_set(&s_buf->ctimer, ANYCAST_TIMEOUT, buf_expired, s_buf);
-			
-		snprintf(addr_buf, 2, "%c", (uint8_t) s_buf->address);
-  		packetbuf_copyfrom(addr_buf, sizeof(addr_buf));
-		netflood_send(&c->netflood_conn, (uint8_t) s_buf->seq_number);
-	} else {
+	/* hold on to the payload while the server is being discovered */
+	s_buf->buf = queuebuf_new_from_packetbuf();
+	if(s_buf->buf == NULL) {
+		PRINTF("[ERROR]\t\tNo queuebuf for anycast data!\n");
+		memb_free(&send_buf_mem, s_buf);
+		return ANYCAST_ERR_FULL;
+	}
+
+	/* join the discovery already in flight for this address, if any */
+	d = discovery_pending(c, dest);
+	if(d == NULL) {
+		d = discovery_new(c, dest);
+		if(d == NULL) {
+			PRINTF("[ERROR]\t\tDiscovery buffer full!\n");
+			queuebuf_free(s_buf->buf);
+			memb_free(&send_buf_mem, s_buf);
+			return ANYCAST_ERR_FULL;
+		}
+		new_discovery = 1;
+	}
+
+	/* store data in buf first */
+	s_buf->address = dest;
+	s_buf->seq_number = d->seq_number;
+	s_buf->conn = c;
+	s_buf->handle = handle;
+	s_buf->rpc = rpc;
+	s_buf->msg_id = c->rdata_id++;
+	s_buf->rediscovered = 0;
+		
+	PRINTF("[LOG]\t\tReceived anycast send. seq:%u|svr:%u|%u bytes\n",
+		s_buf->seq_number, 
+		s_buf->address, 
+		queuebuf_datalen(s_buf->buf));
+
+	list_add(d->requests, s_buf);
+
+	if(!new_discovery) {
+		PRINTF("[LOG]\t\tJoined pending discovery for anycast %u (seq %u).\n",
+			d->address,
+			d->seq_number);
+		return handle;
+	}
+
+	discovery_slots[d->seq_number % ANYCAST_DISCOVERY_SLOTS] = d;
+	discovery_flood(d);
+
+	return handle;
+}
+/*---------------------------------------------------------------------------*/
+int
+anycast_send(struct anycast_conn *c, const anycast_addr_t dest)
+{
+	return send_packet(c, dest, 0);
+}
+/*---------------------------------------------------------------------------*/
+int
+anycast_request(struct anycast_conn *c, const anycast_addr_t dest)
+{
+	return send_packet(c, dest, 1);
+}
+/*---------------------------------------------------------------------------*/
+int
+anycast_reply(struct anycast_conn *c)
+{
+	struct anycast_rpc *r;
+
+	if(!c->rpc_open || packetbuf_datalen() > ANYCAST_DATA_LEN) {
+		PRINTF("[ERROR]\t\tNo request to reply to.\n");
+		return ANYCAST_ERR_INVALID;
+	}
+	c->rpc_open = 0;
+
+	PRINTF("[RPC]\t\tReplying to request %u of %02X:%02X (%u bytes)\n",
+		c->rpc_id,
+		c->rpc_client.u8[1],
+		c->rpc_client.u8[0],
+		packetbuf_datalen());
+
+	r = frame_alloc(offsetof(struct anycast_rpc, data));
+	r->flag = ANYCAST_RPC_REP_FLAG;
+	r->address = c->rpc_address;
+	r->rpc_id = c->rpc_id;
+
+	/* the flood and the request left a route back to the client */
+	mesh_tx(c, &c->rpc_client);
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
+void
+anycast_session_open(struct anycast_conn *c, struct anycast_session *s,
+	const anycast_addr_t addr)
+{
+#if ANYCAST_CACHE_SIZE > 0
+	struct anycast_server_cache *cache;
+#endif
+
+	s->conn = c;
+	s->address = addr;
+	s->bound = 0;
+	s->missed = 0;
+	list_add(sessions, s);
+
+	PRINTF("[SESSION]\tSession to anycast %u opened.\n", addr);
+
+#if ANYCAST_CACHE_SIZE > 0
+	/* a cached server binds the session at once */
+	cache = cache_lookup(addr);
+	if(cache != NULL) {
+		rimeaddr_copy(&s->server, &cache->rime_addr);
+		s->bound = 1;
+	}
+#endif
+	if(!s->bound) {
+		session_discover(s);
+	}
+	ctimer_set(&s->ctimer, ANYCAST_KEEPALIVE_INTERVAL, session_keepalive, s);
+}
+/*---------------------------------------------------------------------------*/
+int
+anycast_session_send(struct anycast_session *s)
+{
+	struct anycast_conn *c = s->conn;
+	struct anycast_send_buffer *s_buf;
+	anycast_handle_t handle;
+
+	/* data sent before the session is bound waits for its discovery */
+	if(!s->bound) {
+		return anycast_send(c, s->address);
+	}
+
+	if(packetbuf_datalen() > ANYCAST_DATA_LEN) {
+		PRINTF("[ERROR]\t\tData length out of range.\n");
+		return ANYCAST_ERR_INVALID;
+	}
+	handle = handle_new();
+
+	if(!c->reliable) {
+		data_send(c, s->address, &s->server, handle);
+		return handle;
+	}
+
+	s_buf = memb_alloc(&send_buf_mem);
+	if(s_buf == NULL) {
 		PRINTF("[ERROR]\t\tSend buffer full!\n");
-	}	
+		return ANYCAST_ERR_FULL;
+	}
+	s_buf->buf = queuebuf_new_from_packetbuf();
+	if(s_buf->buf == NULL) {
+		PRINTF("[ERROR]\t\tNo queuebuf for anycast data!\n");
+		memb_free(&send_buf_mem, s_buf);
+		return ANYCAST_ERR_FULL;
+	}
+	s_buf->address = s->address;
+	s_buf->conn = c;
+	s_buf->handle = handle;
+	s_buf->rpc = 0;
+	s_buf->msg_id = c->rdata_id++;
+	s_buf->rediscovered = 0;
+
+	rdata_start(s_buf, NULL, &s->server);
+	return handle;
+}
+/*---------------------------------------------------------------------------*/
+void
+anycast_session_close(struct anycast_session *s)
+{
+	PRINTF("[SESSION]\tSession to anycast %u closed.\n", s->address);
+
+	ctimer_stop(&s->ctimer);
+	list_remove(sessions, s);
+}
+/*---------------------------------------------------------------------------*/
+int
+anycast_send_large(struct anycast_conn *c, const anycast_addr_t dest,
+	const void *data, uint16_t len)
+{
+#if ANYCAST_MAX_MSG_LEN > 0
+	struct anycast_discovery *d;
+#if ANYCAST_CACHE_SIZE > 0
+	struct anycast_server_cache *cache;
+#endif
+
+	if(len == 0 || len > ANYCAST_MAX_MSG_LEN) {
+		PRINTF("[ERROR]\t\tMessage length out of range.\n");
+		return ANYCAST_ERR_INVALID;
+	}
+
+	if(c->frag_data != NULL) {
+		PRINTF("[ERROR]\t\tFragmented message already in flight!\n");
+		return ANYCAST_ERR_FULL;
+	}
+
+	c->frag_data = data;
+	c->frag_len = len;
+	c->frag_address = dest;
+	c->frag_id++;
+	c->frag_handle = handle_new();
+
+	PRINTF("[FRAG]\t\tApplication sending message %u to anycast %u (%u bytes, %u fragments)\n",
+		c->frag_id,
+		dest,
+		len,
+		FRAG_COUNT(len));
+
+#if ANYCAST_CACHE_SIZE > 0
+	/* stream the message right away to a cached server */
+	cache = cache_lookup(dest);
+	if(cache != NULL) {
+		PRINTF("[CACHE]\t\tAnycast address in cache. %u(%02x:%02X)\n",
+			cache->anycast_addr,
+			cache->rime_addr.u8[1],
+			cache->rime_addr.u8[0]);
+
+		frag_start(c, &cache->rime_addr);
+		return c->frag_handle;
+	}
+#endif
+
+	/* no server was found lately, do not flood again */
+	if(unreachable_check(dest)) {
+		c->frag_data = NULL;
+		return ANYCAST_ERR_UNREACHABLE;
+	}
+
+	/* a single discovery for the whole message, shared with pending sends */
+	d = discovery_pending(c, dest);
+	if(d == NULL) {
+		d = discovery_new(c, dest);
+		if(d == NULL) {
+			PRINTF("[ERROR]\t\tDiscovery buffer full!\n");
+			c->frag_data = NULL;
+			return ANYCAST_ERR_FULL;
+		}
+		discovery_slots[d->seq_number % ANYCAST_DISCOVERY_SLOTS] = d;
+		discovery_flood(d);
+	}
+	d->frag = 1;
+
+	return c->frag_handle;
+#else
+	PRINTF("[ERROR]\t\tLarge messages are not built in.\n");
+	return ANYCAST_ERR_INVALID;
+#endif /* ANYCAST_MAX_MSG_LEN > 0 */
 }
 /*---------------------------------------------------------------------------*/
 void 
 anycast_close(struct anycast_conn *c)
 {
-	struct anycast_bind_address *s;
+	struct anycast_send_buffer *s_buf, *next_buf;
+	struct anycast_discovery *d;
+	struct anycast_gradient *g, *next;
+	struct anycast_reply *r, *next_reply;
+	struct anycast_session *session, *next_session;
+	anycast_handle_t handle;
+	anycast_addr_t addr;
+#if ANYCAST_MAX_MSG_LEN > 0
+	uint8_t err_code = ERR_NO_ROUTE;
+#endif
+	uint8_t count;
+	uint16_t a;
 
-	/* removes anycast listening addresses and frees memory */	
-	while(list_length(c->bind_addrs) > 0) {
-		s = list_chop(c->bind_addrs);
-		
-		PRINTF("[LOG]\t\tUnbinded anycast address: %u\n", 
-			s->address);
-		
-		memb_free(&anycast_mem, s);
+	/* removes anycast listening addresses */	
+	for(a = 0; a < 256; a++) {
+		if(bind_lookup(c, a)) {
+			PRINTF("[LOG]\t\tUnbinded anycast address: %u\n", a);
+		}
 	}
+	memset(c->bind_map, 0, sizeof(c->bind_map));
 	
+	/* stops advertising and removes the gradients learned */
+	c->proactive = 0;
+	ctimer_stop(&c->adv_ctimer);
+	for(g = list_head(gradients); g != NULL; g = next) {
+		next = g->next;
+		if(g->conn == c) {
+			gradient_remove(g);
+		}
+	}
+
+	/* drops the responses waiting for their backoff */
+	for(r = list_head(replies); r != NULL; r = next_reply) {
+		next_reply = r->next;
+		if(r->conn == c) {
+			ctimer_stop(&r->ctimer);
+			list_remove(replies, r);
+			memb_free(&reply_mem, r);
+		}
+	}
+
+	/* closes the sessions */
+	for(session = list_head(sessions); session != NULL;
+		session = next_session) {
+		next_session = session->next;
+		if(session->conn == c) {
+			anycast_session_close(session);
+		}
+	}
+
+	/* cancels the discoveries, the packets waiting for them time out */
+	for(a = 0; a < ANYCAST_DISCOVERY_SLOTS; a++) {
+		d = discovery_slots[a];
+		if(d == NULL || d->conn != c) {
+			continue;
+		}
+		discovery_slots[a] = NULL;
+		wheel_stop(&d->timer);
+#if ANYCAST_MAX_MSG_LEN > 0
+		if(d->frag) {
+			err_code = ERR_NO_SERVER_FOUND;
+		}
+#endif
+		while((s_buf = list_pop(d->requests)) != NULL) {
+			handle = s_buf->handle;
+			queuebuf_free(s_buf->buf);
+			memb_free(&send_buf_mem, s_buf);
+			if(c->cb->timedout) {
+				c->cb->timedout(c, handle, d->address,
+					ERR_NO_SERVER_FOUND);
+			}
+		}
+		memb_free(&discovery_mem, d);
+	}
+
+	/* drops the requests waiting for their reply */
+	for(s_buf = list_head(rpcs); s_buf != NULL; s_buf = next_buf) {
+		next_buf = s_buf->next;
+		if(s_buf->conn == c) {
+			handle = s_buf->handle;
+			addr = s_buf->address;
+			list_remove(rpcs, s_buf);
+			wheel_stop(&s_buf->timer);
+			memb_free(&send_buf_mem, s_buf);
+			if(c->cb->timedout) {
+				c->cb->timedout(c, handle, addr, ERR_NO_RESPONSE);
+			}
+		}
+	}
+
+	/* sends the pending batch and drops the unacknowledged messages */
+	batch_flush(c);
+	for(s_buf = list_head(unacked); s_buf != NULL; s_buf = next_buf) {
+		next_buf = s_buf->next;
+		if(s_buf->conn == c) {
+			handle = s_buf->handle;
+			addr = s_buf->address;
+			rdata_free(s_buf);
+			if(c->cb->timedout) {
+				c->cb->timedout(c, handle, addr, ERR_NO_ROUTE);
+			}
+		}
+	}
+
+	/* the data frame mesh holds is dropped with the mesh connection */
+	count = c->queued_count;
+	c->queued_count = 0;
+	handles_timedout(c, c->queued_handles, count, c->queued_address,
+		ERR_NO_ROUTE);
+
+#if ANYCAST_MAX_MSG_LEN > 0
+	/* drops the fragmented messages */
+	ctimer_stop(&c->frag_ctimer);
+	if(c->frag_data != NULL) {
+		c->frag_data = NULL;
+		if(c->cb->timedout) {
+			c->cb->timedout(c, c->frag_handle, c->frag_address, err_code);
+		}
+	}
+	if(reasm.conn == c) {
+		wheel_stop(&reasm.timer);
+		reasm.conn = NULL;
+	}
+#endif
+
 	netflood_close(&c->netflood_conn);
 	mesh_close(&c->mesh_conn);
+	broadcast_close(&c->adv_conn);
+	unicast_close(&c->fwd_conn);
 }
 /*---------------------------------------------------------------------------*/
 /**
@@ -419,9 +4085,14 @@ PROCESS_THREAD(status_process, ev, data)
 {
 	static struct etimer et;
 	static struct anycast_conn *a_conn = NULL;
-	struct anycast_bind_address *a = NULL;	
+	uint16_t a;
 	struct anycast_send_buffer *b = NULL; 
-	uint8_t i = 0;
+	struct anycast_discovery *d = NULL;
+	struct anycast_gradient *g = NULL;
+#if ANYCAST_CACHE_SIZE > 0
+	struct anycast_server_cache *c = NULL;
+#endif
+	uint8_t i = 0, j;
 	char buf[100];
 	rimeaddr_t addr;
 	
@@ -444,19 +4115,48 @@ PROCESS_THREAD(status_process, ev, data)
 		/* prints rime and anycast addresses */
 		snprintf(buf, 100, "[ADDR]\t\tRIME:%02X:%02X", 
 			addr.u8[1], addr.u8[0]);	
-		for(a = list_head(a_conn->bind_addrs); a != NULL; a = a->next){
+		for(a = 0; a < 256; a++) {
+			if(!bind_lookup(a_conn, a)) {
+				continue;
+			}
 			snprintf(buf, 100, "%s | ANYCAST%u:%u", 
-				buf, ++i, a->address);	
+				buf, ++i, a);
   		}
 		PRINTF("%s\n", buf);
 
-		/* prints send buffer content */
-		for(b = list_head(send_buf); b != NULL; b = b->next ) {
-      			PRINTF("[BUF]\t\t%u|%u|'%s'\n", 
-				b->seq_number,
-				b->address, 
-				b->data);
-    		}
+		/* prints send buffer content of every outstanding discovery */
+		for(j = 0; j < ANYCAST_DISCOVERY_SLOTS; j++) {
+			d = discovery_slots[j];
+			if(d == NULL) {
+				continue;
+			}
+			for(b = list_head(d->requests); b != NULL; b = b->next ) {
+      				PRINTF("[BUF]\t\t%u|%u|%u bytes\n", 
+					b->seq_number,
+					b->address, 
+					queuebuf_datalen(b->buf));
+    			}
+		}
+
+		/* prints gradients toward anycast servers */
+		for(g = list_head(gradients); g != NULL; g = g->next) {
+			PRINTF("[GRAD]\t\t%u(%02X:%02X|%u hops)\n",
+				g->address,
+				g->nexthop.u8[1],
+				g->nexthop.u8[0],
+				g->hops);
+		}
+
+#if ANYCAST_CACHE_SIZE > 0
+		/* prints cache content, most recently used first */
+		for(c = list_head(anycast_cache); c != NULL; c = c->next) {
+        		PRINTF("[CACHE]\t\t%u(%02X:%02X|%u hops)\n", 
+				c->anycast_addr, 
+				c->rime_addr.u8[1], 
+				c->rime_addr.u8[0],
+				c->hops);
+        	}
+#endif
   	}
 
   	PROCESS_END();
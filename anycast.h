@@ -6,7 +6,41 @@
  *
  * \section channels Channels
  *
- * The anycast modules uses 4 channels; 1 for the netflood and 3 for the mesh.
+ * The anycast modules uses 6 channels; 1 for the netflood, 3 for the mesh, 1 for
+ * the broadcast of advertisements and 1 for the unicast along the gradient.
+ *
+ * \section routes Routes
+ *
+ * Every node a discovery flood passes keeps a route back to the client. The
+ * server's response is passed hop by hop along these routes, and installs
+ * routes toward the server on its way, so that the data usually reaches the
+ * server over mesh without a route discovery of its own.
+ *
+ * Servers answer after a backoff that grows with their distance to the client
+ * and announce their response to their neighbors. A server that hears, or
+ * relays, the response of a server as good drops its own.
+ *
+ * \section proactive Proactive mode
+ *
+ * A connection opened with anycast_open_proactive() advertises the anycast
+ * addresses it listens on and the ones it has learned, Trickle timed. Every
+ * node keeps the next hop toward the nearest server of each address, and
+ * anycast_send() forwards data along that gradient without discovery.
+ *
+ * \section fragments Large messages
+ *
+ * anycast_send_large() sends messages of up to ANYCAST_MAX_MSG_LEN bytes over
+ * the mesh in fragments, after a single discovery. The server acknowledges the
+ * fragments it holds with a bitmap, and only the missing ones are sent again.
+ *
+ * \section cache Server cache
+ *
+ * Built with ANYCAST_CONF_CACHE_SIZE, a node keeps the server chosen for each
+ * of the last anycast addresses it used. Data to a cached address is sent to
+ * the server without a discovery, and the node answers discovery floods for
+ * the address on the server's behalf. The least recently used entry makes
+ * room for a new one. An entry lives longer every time its server takes data,
+ * and is dropped as soon as data to the server fails.
  */
 
 /**
@@ -21,13 +55,50 @@
 
 #include "net/rime/netflood.h"
 #include "net/rime/mesh.h"
+#include "net/rime/broadcast.h"
+#include "net/rime/unicast.h"
 #include "lib/list.h"
 
 /**
- * \brief	Period to timeout a received anycast send request.
+ * \brief	Period to timeout a received anycast send request once the
+ *		whole network has been flooded.
  */
 #define ANYCAST_TIMEOUT (CLOCK_SECOND * 10)
 
+/**
+ * \brief	Hop radius of the first ring of an expanding ring discovery.
+ *		Set to 0 to flood the whole network at once.
+ */
+#ifdef ANYCAST_CONF_RING_START
+#define ANYCAST_RING_START ANYCAST_CONF_RING_START
+#else
+#define ANYCAST_RING_START 1
+#endif
+
+/**
+ * \brief	Largest hop radius tried before the whole network is flooded.
+ *		The radius doubles on every ring.
+ */
+#ifdef ANYCAST_CONF_RING_MAX
+#define ANYCAST_RING_MAX ANYCAST_CONF_RING_MAX
+#else
+#define ANYCAST_RING_MAX 2
+#endif
+
+/**
+ * \brief	Period to wait for a response per hop of the ring radius.
+ *		Once discoveries of an anycast address were answered, the
+ *		period estimated from their round-trip times is used instead
+ *		when it is shorter. It is scaled by the hops of a wider ring,
+ *		or by ANYCAST_MAX_HOPS for the whole network, over the hops
+ *		of the server that answered, and also bounds ANYCAST_TIMEOUT.
+ */
+#ifdef ANYCAST_CONF_RING_HOP_TIMEOUT
+#define ANYCAST_RING_HOP_TIMEOUT ANYCAST_CONF_RING_HOP_TIMEOUT
+#else
+#define ANYCAST_RING_HOP_TIMEOUT (CLOCK_SECOND * 3)
+#endif
+
 /**
  * \brief	Flag value for response in anycase message.
  */
@@ -38,11 +109,470 @@
  */
 #define ANYCAST_DATA_FLAG 1
 
+/**
+ * \brief	Flag value for a discovery request in the netflood message.
+ */
+#define ANYCAST_REQ_FLAG 2
+
+/**
+ * \brief	Flag value for a discovery request that carries the data itself.
+ */
+#define ANYCAST_EAGER_FLAG 3
+
+/**
+ * \brief	Flag value for an advertisement in proactive mode.
+ */
+#define ANYCAST_ADV_FLAG 4
+
+/**
+ * \brief	Flag value for data forwarded along the gradient in proactive mode.
+ */
+#define ANYCAST_FWD_FLAG 5
+
+/**
+ * \brief	Flag value for a fragment of a message larger than
+ *		ANYCAST_DATA_LEN.
+ */
+#define ANYCAST_FRAG_FLAG 6
+
+/**
+ * \brief	Flag value for the selective acknowledgement of fragments.
+ */
+#define ANYCAST_FRAG_ACK_FLAG 7
+
+/**
+ * \brief	Flag value for several data records sent in one frame.
+ */
+#define ANYCAST_BATCH_FLAG 8
+
+/**
+ * \brief	Flag value for data the server acknowledges in reliable mode.
+ */
+#define ANYCAST_RDATA_FLAG 9
+
+/**
+ * \brief	Flag value for the acknowledgement of data in reliable mode.
+ */
+#define ANYCAST_ACK_FLAG 10
+
+/**
+ * \brief	Flag value for a request sent with anycast_request().
+ */
+#define ANYCAST_RPC_REQ_FLAG 11
+
+/**
+ * \brief	Flag value for the reply sent with anycast_reply().
+ */
+#define ANYCAST_RPC_REP_FLAG 12
+
+/**
+ * \brief	Flag value for the keepalive of a session.
+ */
+#define ANYCAST_KEEPALIVE_FLAG 13
+
+/**
+ * \brief	Flag value for the answer of a server to a keepalive.
+ */
+#define ANYCAST_KEEPALIVE_ACK_FLAG 14
+
 /**
  * \brief	Maximum length of data application is allowed to send.
  */
 #define ANYCAST_DATA_LEN 103
 
+/**
+ * \brief	Size in bytes of the bitmap of bound anycast addresses, one bit
+ *		for every value of anycast_addr_t.
+ */
+#define ANYCAST_BIND_MAP_LEN 32
+
+/**
+ * \brief	Maximum number of buffered anycast send requests.
+ */
+#ifdef ANYCAST_CONF_SEND_BUF_NUM
+#define ANYCAST_SEND_BUF_NUM ANYCAST_CONF_SEND_BUF_NUM
+#else
+#define ANYCAST_SEND_BUF_NUM 5
+#endif
+
+/**
+ * \brief	Maximum number of outstanding anycast discoveries.
+ */
+#ifdef ANYCAST_CONF_DISCOVERY_NUM
+#define ANYCAST_DISCOVERY_NUM ANYCAST_CONF_DISCOVERY_NUM
+#else
+#define ANYCAST_DISCOVERY_NUM 5
+#endif
+
+/**
+ * \brief	Number of slots of the table that matches responses to
+ *		outstanding discoveries by sequence number. Must be larger than
+ *		ANYCAST_DISCOVERY_NUM and at most 256.
+ */
+#define ANYCAST_DISCOVERY_SLOTS (2 * ANYCAST_DISCOVERY_NUM)
+
+#if ANYCAST_DISCOVERY_NUM > 128
+#error "ANYCAST_DISCOVERY_NUM must be at most 128"
+#endif
+
+/**
+ * \brief	Maximum length of data piggybacked on the discovery flood when
+ *		eager mode is enabled. Longer data falls back to discovery.
+ */
+#ifdef ANYCAST_CONF_EAGER_LEN
+#define ANYCAST_EAGER_LEN ANYCAST_CONF_EAGER_LEN
+#else
+#define ANYCAST_EAGER_LEN 32
+#endif
+
+/**
+ * \brief	Minimum, and initial, Trickle interval between advertisements.
+ */
+#ifdef ANYCAST_CONF_ADV_IMIN
+#define ANYCAST_ADV_IMIN ANYCAST_CONF_ADV_IMIN
+#else
+#define ANYCAST_ADV_IMIN (CLOCK_SECOND * 4)
+#endif
+
+/**
+ * \brief	Number of times the advertisement interval doubles at most.
+ */
+#ifdef ANYCAST_CONF_ADV_IMAX_DOUBLINGS
+#define ANYCAST_ADV_IMAX_DOUBLINGS ANYCAST_CONF_ADV_IMAX_DOUBLINGS
+#else
+#define ANYCAST_ADV_IMAX_DOUBLINGS 6
+#endif
+
+/**
+ * \brief	Maximum Trickle interval between advertisements, which must fit
+ *		in a clock_time_t.
+ */
+#define ANYCAST_ADV_IMAX \
+	((unsigned long)ANYCAST_ADV_IMIN << ANYCAST_ADV_IMAX_DOUBLINGS)
+
+/**
+ * \brief	Number of consistent advertisements heard in an interval that
+ *		suppress the node's own advertisement.
+ */
+#ifdef ANYCAST_CONF_ADV_REDUNDANCY
+#define ANYCAST_ADV_REDUNDANCY ANYCAST_CONF_ADV_REDUNDANCY
+#else
+#define ANYCAST_ADV_REDUNDANCY 2
+#endif
+
+/**
+ * \brief	Maximum number of anycast addresses in an advertisement.
+ */
+#ifdef ANYCAST_CONF_ADV_ENTRIES
+#define ANYCAST_ADV_ENTRIES ANYCAST_CONF_ADV_ENTRIES
+#else
+#define ANYCAST_ADV_ENTRIES 16
+#endif
+
+/**
+ * \brief	Maximum number of anycast addresses a node keeps a gradient for.
+ */
+#ifdef ANYCAST_CONF_GRADIENT_SIZE
+#define ANYCAST_GRADIENT_SIZE ANYCAST_CONF_GRADIENT_SIZE
+#else
+#define ANYCAST_GRADIENT_SIZE 8
+#endif
+
+/**
+ * \brief	Period after which a gradient that was not advertised again expires.
+ */
+#define ANYCAST_GRADIENT_LIFETIME (3 * ANYCAST_ADV_IMAX)
+
+/**
+ * \brief	Number of hops a fully loaded server is worth when choosing among
+ *		the servers that responded to a discovery. 0 always chooses the
+ *		nearest server.
+ */
+#ifdef ANYCAST_CONF_LOAD_HOPS
+#define ANYCAST_LOAD_HOPS ANYCAST_CONF_LOAD_HOPS
+#else
+#define ANYCAST_LOAD_HOPS 4
+#endif
+
+/**
+ * \brief	Backoff per hop to the client before a server answers a
+ *		discovery, plus as much random jitter. A server keeps silent if
+ *		it hears a server as good answer first. 0 answers at once.
+ */
+#ifdef ANYCAST_CONF_REPLY_BACKOFF
+#define ANYCAST_REPLY_BACKOFF ANYCAST_CONF_REPLY_BACKOFF
+#else
+#define ANYCAST_REPLY_BACKOFF (CLOCK_SECOND / 16)
+#endif
+
+/**
+ * \brief	Maximum number of responses waiting for their backoff.
+ */
+#ifdef ANYCAST_CONF_REPLY_NUM
+#define ANYCAST_REPLY_NUM ANYCAST_CONF_REPLY_NUM
+#else
+#define ANYCAST_REPLY_NUM 4
+#endif
+
+/**
+ * \brief	Period over which a server counts its responses to discoveries
+ *		against the rate threshold of admission control.
+ */
+#ifdef ANYCAST_CONF_ADMIT_PERIOD
+#define ANYCAST_ADMIT_PERIOD ANYCAST_CONF_ADMIT_PERIOD
+#else
+#define ANYCAST_ADMIT_PERIOD (CLOCK_SECOND * 4)
+#endif
+
+/**
+ * \brief	Number of anycast addresses whose server is cached. 0 builds
+ *		the protocol without the server cache.
+ */
+#ifdef ANYCAST_CONF_CACHE_SIZE
+#define ANYCAST_CACHE_SIZE ANYCAST_CONF_CACHE_SIZE
+#else
+#define ANYCAST_CACHE_SIZE 0
+#endif
+
+/**
+ * \brief	Period a cached server is used before it is discovered again.
+ */
+#ifdef ANYCAST_CONF_CACHE_LIFETIME
+#define ANYCAST_CACHE_LIFETIME ANYCAST_CONF_CACHE_LIFETIME
+#else
+#define ANYCAST_CACHE_LIFETIME ANYCAST_TIMEOUT
+#endif
+
+/**
+ * \brief	Longest lifetime of a cached server. The lifetime of an entry
+ *		doubles every time its server takes data, from
+ *		ANYCAST_CACHE_LIFETIME up to this period.
+ */
+#ifdef ANYCAST_CONF_CACHE_LIFETIME_MAX
+#define ANYCAST_CACHE_LIFETIME_MAX ANYCAST_CONF_CACHE_LIFETIME_MAX
+#else
+#define ANYCAST_CACHE_LIFETIME_MAX (ANYCAST_CACHE_LIFETIME * 16)
+#endif
+
+/**
+ * \brief	Number of anycast addresses whose discovery round-trip time is
+ *		estimated. 0 builds the protocol with fixed discovery timeouts.
+ */
+#ifdef ANYCAST_CONF_RTT_NUM
+#define ANYCAST_RTT_NUM ANYCAST_CONF_RTT_NUM
+#else
+#define ANYCAST_RTT_NUM 8
+#endif
+
+/**
+ * \brief	Shortest period to wait for a response to a discovery with a
+ *		round-trip time estimate.
+ */
+#ifdef ANYCAST_CONF_RTO_MIN
+#define ANYCAST_RTO_MIN ANYCAST_CONF_RTO_MIN
+#else
+#define ANYCAST_RTO_MIN (CLOCK_SECOND / 2)
+#endif
+
+/**
+ * \brief	Maximum number of times the period to wait for a response is
+ *		doubled after discoveries of the address timed out.
+ */
+#ifdef ANYCAST_CONF_RTO_BACKOFF_MAX
+#define ANYCAST_RTO_BACKOFF_MAX ANYCAST_CONF_RTO_BACKOFF_MAX
+#else
+#define ANYCAST_RTO_BACKOFF_MAX 4
+#endif
+
+/**
+ * \brief	Number of anycast addresses no server was found for that are
+ *		remembered. 0 builds the protocol without them.
+ */
+#ifdef ANYCAST_CONF_UNREACHABLE_NUM
+#define ANYCAST_UNREACHABLE_NUM ANYCAST_CONF_UNREACHABLE_NUM
+#else
+#define ANYCAST_UNREACHABLE_NUM 4
+#endif
+
+/**
+ * \brief	Period sends to an anycast address are refused after the first
+ *		discovery for it failed. It doubles with every further failure.
+ */
+#ifdef ANYCAST_CONF_UNREACHABLE_BACKOFF
+#define ANYCAST_UNREACHABLE_BACKOFF ANYCAST_CONF_UNREACHABLE_BACKOFF
+#else
+#define ANYCAST_UNREACHABLE_BACKOFF ANYCAST_TIMEOUT
+#endif
+
+/**
+ * \brief	Longest period sends to an anycast address are refused.
+ */
+#ifdef ANYCAST_CONF_UNREACHABLE_BACKOFF_MAX
+#define ANYCAST_UNREACHABLE_BACKOFF_MAX ANYCAST_CONF_UNREACHABLE_BACKOFF_MAX
+#else
+#define ANYCAST_UNREACHABLE_BACKOFF_MAX (ANYCAST_UNREACHABLE_BACKOFF * 16)
+#endif
+
+/**
+ * \brief	Distance at which an anycast server is unreachable. Also the
+ *		maximum number of hops of data forwarded along the gradient.
+ */
+#define ANYCAST_MAX_HOPS 16
+
+/**
+ * \brief	Payload bytes carried by one fragment of a large message.
+ */
+#define ANYCAST_FRAG_LEN (ANYCAST_DATA_LEN - 3)
+
+/**
+ * \brief	Maximum number of fragments of a message, one bit each in the
+ *		16-bit selective acknowledgement.
+ */
+#define ANYCAST_FRAG_MAX 16
+
+/**
+ * \brief	Maximum length of a message sent with anycast_send_large(),
+ *		which is also the size of the reassembly buffer. 0 builds the
+ *		protocol without large messages, and anycast_send_large()
+ *		returns ANYCAST_ERR_INVALID.
+ */
+#ifdef ANYCAST_CONF_MAX_MSG_LEN
+#define ANYCAST_MAX_MSG_LEN ANYCAST_CONF_MAX_MSG_LEN
+#else
+#define ANYCAST_MAX_MSG_LEN 1024
+#endif
+
+#if ANYCAST_MAX_MSG_LEN > ANYCAST_FRAG_MAX * ANYCAST_FRAG_LEN
+#error "ANYCAST_MAX_MSG_LEN does not fit in ANYCAST_FRAG_MAX fragments"
+#endif
+
+/**
+ * \brief	Pause between two fragments sent to the server.
+ */
+#ifdef ANYCAST_CONF_FRAG_INTERVAL
+#define ANYCAST_FRAG_INTERVAL ANYCAST_CONF_FRAG_INTERVAL
+#else
+#define ANYCAST_FRAG_INTERVAL (CLOCK_SECOND / 16)
+#endif
+
+/**
+ * \brief	Period to wait for the acknowledgement of a round of fragments.
+ */
+#ifdef ANYCAST_CONF_FRAG_ACK_TIMEOUT
+#define ANYCAST_FRAG_ACK_TIMEOUT ANYCAST_CONF_FRAG_ACK_TIMEOUT
+#else
+#define ANYCAST_FRAG_ACK_TIMEOUT (CLOCK_SECOND * 2)
+#endif
+
+/**
+ * \brief	Number of times missing fragments are sent again before the
+ *		message is given up.
+ */
+#ifdef ANYCAST_CONF_FRAG_RETRIES
+#define ANYCAST_FRAG_RETRIES ANYCAST_CONF_FRAG_RETRIES
+#else
+#define ANYCAST_FRAG_RETRIES 4
+#endif
+
+/**
+ * \brief	Time a server keeps a partly or fully reassembled message.
+ */
+#define ANYCAST_FRAG_LIFETIME \
+	(2 * (ANYCAST_FRAG_RETRIES + 1) * ANYCAST_FRAG_ACK_TIMEOUT)
+
+/**
+ * \brief	Period to wait for the acknowledgement of data in reliable mode,
+ *		doubled with every retransmission.
+ */
+#ifdef ANYCAST_CONF_ACK_TIMEOUT
+#define ANYCAST_ACK_TIMEOUT ANYCAST_CONF_ACK_TIMEOUT
+#else
+#define ANYCAST_ACK_TIMEOUT (CLOCK_SECOND * 2)
+#endif
+
+/**
+ * \brief	Number of retransmissions to a server in reliable mode before
+ *		failing over to another server.
+ */
+#ifdef ANYCAST_CONF_RETRIES
+#define ANYCAST_RETRIES ANYCAST_CONF_RETRIES
+#else
+#define ANYCAST_RETRIES 3
+#endif
+
+/**
+ * \brief	Number of reliable messages a server remembers to acknowledge
+ *		retransmissions without delivering them twice.
+ */
+#ifdef ANYCAST_CONF_SEEN_NUM
+#define ANYCAST_SEEN_NUM ANYCAST_CONF_SEEN_NUM
+#else
+#define ANYCAST_SEEN_NUM 8
+#endif
+
+/**
+ * \brief	Number of discoveries a node remembers having served, so that
+ *		the copies netflood keeps delivering do not reach the
+ *		application or admission control twice.
+ */
+#ifdef ANYCAST_CONF_SERVED_NUM
+#define ANYCAST_SERVED_NUM ANYCAST_CONF_SERVED_NUM
+#else
+#define ANYCAST_SERVED_NUM 4
+#endif
+
+/**
+ * \brief	Period a client waits for the reply to a request.
+ */
+#ifdef ANYCAST_CONF_RPC_TIMEOUT
+#define ANYCAST_RPC_TIMEOUT ANYCAST_CONF_RPC_TIMEOUT
+#else
+#define ANYCAST_RPC_TIMEOUT (CLOCK_SECOND * 4)
+#endif
+
+/**
+ * \brief	Period between two keepalives of a session to its server.
+ */
+#ifdef ANYCAST_CONF_KEEPALIVE_INTERVAL
+#define ANYCAST_KEEPALIVE_INTERVAL ANYCAST_CONF_KEEPALIVE_INTERVAL
+#else
+#define ANYCAST_KEEPALIVE_INTERVAL (CLOCK_SECOND * 30)
+#endif
+
+/**
+ * \brief	Number of keepalives in a row the server of a session may leave
+ *		unanswered before the session is bound to another server.
+ */
+#ifdef ANYCAST_CONF_KEEPALIVE_MISSES
+#define ANYCAST_KEEPALIVE_MISSES ANYCAST_CONF_KEEPALIVE_MISSES
+#else
+#define ANYCAST_KEEPALIVE_MISSES 3
+#endif
+
+/**
+ * \brief	Number of slots of the timer wheel that expires discoveries,
+ *		cache entries and gradients.
+ */
+#ifdef ANYCAST_CONF_WHEEL_SLOTS
+#define ANYCAST_WHEEL_SLOTS ANYCAST_CONF_WHEEL_SLOTS
+#else
+#define ANYCAST_WHEEL_SLOTS 16
+#endif
+
+/**
+ * \brief	Period of a tick of the timer wheel, i.e. its resolution.
+ */
+#ifdef ANYCAST_CONF_WHEEL_TICK
+#define ANYCAST_WHEEL_TICK ANYCAST_CONF_WHEEL_TICK
+#else
+#define ANYCAST_WHEEL_TICK (CLOCK_SECOND / 8)
+#endif
+
+#if 3 * ANYCAST_ADV_IMIN * (1L << ANYCAST_ADV_IMAX_DOUBLINGS) / \
+	ANYCAST_WHEEL_TICK / ANYCAST_WHEEL_SLOTS > 0xffff
+#error "ANYCAST_GRADIENT_LIFETIME does not fit on the timer wheel"
+#endif
+
 /**
  * \brief	Error code when no anycast server replied.
  */
@@ -54,11 +584,45 @@
  */
 #define ERR_NO_ROUTE 1
 
+/**
+ * \brief	Error code when the server did not reply to a request in time.
+ */
+#define ERR_NO_RESPONSE 2
+
+/**
+ * \brief	Returned by anycast_send() when no send buffer, queuebuf or
+ *		discovery is left for the packet.
+ */
+#define ANYCAST_ERR_FULL -1
+
+/**
+ * \brief	Returned by anycast_send() when the packet is too long.
+ */
+#define ANYCAST_ERR_INVALID -2
+
+/**
+ * \brief	Returned by anycast_send() while no server was found for the
+ *		anycast address lately.
+ */
+#define ANYCAST_ERR_UNREACHABLE -3
+
+/**
+ * \brief	Maximum number of records in a batch frame.
+ */
+#ifdef ANYCAST_CONF_BATCH_RECORDS
+#define ANYCAST_BATCH_RECORDS ANYCAST_CONF_BATCH_RECORDS
+#else
+#define ANYCAST_BATCH_RECORDS 8
+#endif
+
 struct anycast_conn;
 
 /* 1 byte anycast address */
 typedef uint8_t anycast_addr_t;
 
+/* handle of a packet, from 0 to 0x7fff, returned by anycast_send() */
+typedef int16_t anycast_handle_t;
+
 /**
  * \brief     Anycast callbacks
  */
@@ -69,35 +633,87 @@ struct anycast_callbacks {
  * \param originator The link-layer address of the sender
  * \param anycast_addr The anycast address of the server
  * \param data A pointer to the data received
+ * \param len  The length of the data received in bytes
  *
  * This function is called when the server receives an anycast data message.
+ * The data is not NUL-terminated and may hold any binary value.
  *
  */
   void (* recv)(struct anycast_conn *c, const rimeaddr_t * originator,
-    const anycast_addr_t anycast_addr, char *data);
+    const anycast_addr_t anycast_addr, char *data, uint16_t len);
  /**
  * \brief      Callback for sent anycast data message
  * \param c    A pointer to a struct anycast_conn
+ * \param handle The handle returned when the packet was sent
  * \param anycast_addr The anycast address of the server
- * \param data A pointer to the data received
+ * \param data A pointer to the data sent
+ * \param len  The length of the data sent in bytes
  *
  * This function is called when the actual data packet is sent after the nearest
  * server has been figured out.
  *
  */
-  void (* sent)(struct anycast_conn *c,	const anycast_addr_t anycast_addr,
-		 char *data);
+  void (* sent)(struct anycast_conn *c, anycast_handle_t handle,
+		 const anycast_addr_t anycast_addr, char *data, uint16_t len);
  /**
  * \brief      Timeout callback
  * \param c    A pointer to a struct anycast_conn
- * \param err_code ERR_NO_SERVER_FOUND or ERR_NO_ROUTE
+ * \param handle The handle returned when the packet was sent
+ * \param anycast_addr The anycast address the packet was sent to
+ * \param err_code ERR_NO_SERVER_FOUND, ERR_NO_ROUTE or ERR_NO_RESPONSE
  *
  * This function is called when a timeout occurred. When no server supporting the anycast
  * destination address could be found, the error code is set to ERR_NO_SERVER_FOUND. When the mesh
  * layer could not found a route for the data message, the error code is set to ERR_NO_ROUTE.
  *
  */
-  void (* timedout)(struct anycast_conn *c, const uint8_t err_code);
+  void (* timedout)(struct anycast_conn *c, anycast_handle_t handle,
+		 const anycast_addr_t anycast_addr, const uint8_t err_code);
+ /**
+ * \brief      Callback for the reply to a request
+ * \param c    A pointer to a struct anycast_conn
+ * \param handle The handle returned by anycast_request()
+ * \param server The link-layer address of the server that replied
+ * \param anycast_addr The anycast address the request was sent to
+ * \param data A pointer to the reply
+ * \param len  The length of the reply in bytes
+ *
+ * This function is called when the server answered a request with
+ * anycast_reply(). It may be NULL if the application sends no requests.
+ *
+ */
+  void (* response)(struct anycast_conn *c, anycast_handle_t handle,
+		 const rimeaddr_t *server, const anycast_addr_t anycast_addr,
+		 char *data, uint16_t len);
+};
+
+/**
+ * \brief	Admission control thresholds and state of a server
+ */
+struct anycast_admission {
+  /* load at which discoveries are left to other servers, 0 for no limit */
+  uint8_t max_load;
+  /* responses per ANYCAST_ADMIT_PERIOD at most, 0 for no limit */
+  uint8_t max_rate;
+  /* responses sent in the current period */
+  uint8_t responses;
+  /* non-zero while the server answers discoveries */
+  uint8_t admitting;
+  /* discoveries left to other servers since anycast_open() */
+  uint16_t refused;
+  clock_time_t period_start;
+};
+
+/**
+ * \brief	Discovery recently served or proxied by a node
+ */
+struct anycast_served {
+  rimeaddr_t originator;
+  uint8_t seq;
+  /* radius of the ring answered, 0xff if none yet */
+  uint8_t ring;
+  /* decision of admission control */
+  uint8_t admitted;
 };
 
 /**
@@ -106,16 +722,95 @@ struct anycast_callbacks {
 struct anycast_conn {
   struct mesh_conn mesh_conn;
   struct netflood_conn netflood_conn;
-  /* list of anycast addresses this server is listening on */
-  LIST_STRUCT(bind_addrs);
+  /* anycast addresses this server is listening on, one bit per address */
+  uint8_t bind_map[ANYCAST_BIND_MAP_LEN];
   const struct anycast_callbacks *cb;
+  /* non-zero if small data is piggybacked on the discovery flood */
+  uint8_t eager;
+  /* time to collect responses before choosing the nearest server */
+  clock_time_t collect_window;
+  /* proactive mode advertisements and forwarding along the gradient */
+  struct broadcast_conn adv_conn;
+  struct unicast_conn fwd_conn;
+  struct ctimer adv_ctimer;
+  clock_time_t adv_interval;
+  clock_time_t adv_remaining;
+  uint8_t adv_counter;
+  uint8_t proactive;
+#if ANYCAST_MAX_MSG_LEN > 0
+  /* message sent in fragments with anycast_send_large() */
+  struct ctimer frag_ctimer;
+  const uint8_t *frag_data;
+  uint16_t frag_len;
+  uint16_t frag_acked;
+  rimeaddr_t frag_server;
+  anycast_addr_t frag_address;
+  uint8_t frag_id;
+  uint8_t frag_next;
+  uint8_t frag_rounds;
+  /* message sent in fragments, completed with frag_handle */
+  anycast_handle_t frag_handle;
+#endif
+  /* handles of the data frame handed to mesh, and of the frame mesh holds
+     while it discovers a route */
+  anycast_handle_t tx_handles[ANYCAST_BATCH_RECORDS];
+  anycast_handle_t queued_handles[ANYCAST_BATCH_RECORDS];
+  anycast_addr_t tx_address;
+  anycast_addr_t queued_address;
+  rimeaddr_t tx_server;
+  rimeaddr_t queued_server;
+  uint8_t tx_count;
+  uint8_t queued_count;
+  uint8_t tx_busy;
+  /* load this server declares in its responses, 0 idle to 255 saturated */
+  uint8_t load;
+  struct anycast_admission admission;
+  /* request being delivered to recv, answered with anycast_reply() */
+  rimeaddr_t rpc_client;
+  anycast_addr_t rpc_address;
+  uint8_t rpc_id;
+  uint8_t rpc_open;
+  /* discoveries served last, as a ring, since netflood repeats them to a
+     node that stops the flood */
+  struct anycast_served served[ANYCAST_SERVED_NUM];
+  uint8_t served_next;
+  /* non-zero if data is acknowledged by the server */
+  uint8_t reliable;
+  uint8_t rdata_id;
+  /* data records waiting to be sent to one server in a single frame */
+  struct ctimer batch_ctimer;
+  clock_time_t batch_delay;
+  uint8_t batch_threshold;
+  rimeaddr_t batch_server;
+  anycast_addr_t batch_address;
+  uint8_t batch_count;
+  uint8_t batch_len;
+  uint8_t batch_data[ANYCAST_DATA_LEN];
+  anycast_handle_t batch_handles[ANYCAST_BATCH_RECORDS];
+};
+
+/**
+ * \brief	A flow of data from a client to the server it is bound to
+ */
+struct anycast_session {
+  struct anycast_session *next;
+  struct anycast_conn *conn;
+  struct ctimer ctimer;
+  rimeaddr_t server;
+  anycast_addr_t address;
+  /* non-zero once a server has been chosen */
+  uint8_t bound;
+  /* keepalives sent since the server last answered */
+  uint8_t missed;
 };
 
 /**
  * \brief      Open an anycast connection
  * \param c    A pointer to a struct anycast_conn
  * \param channels The channel on which the netflood connection will operate on. (The channel
-                    number passed to the mesh connection is channels + 1)
+                    number passed to the mesh connection is channels + 1, the broadcast
+                    connection of the proactive mode uses channels + 4 and the unicast
+                    connection for gradients and responses uses channels + 5)
  * \param callbacks Pointer to callback structure
  *
  *             This function sets up an anycast connection on the
@@ -131,39 +826,304 @@ struct anycast_conn {
 void anycast_open(struct anycast_conn *c, uint16_t channels,
 	       const struct anycast_callbacks *callbacks);
 
+/**
+ * \brief      Open an anycast connection in proactive mode
+ * \param c    A pointer to a struct anycast_conn
+ * \param channels The channel on which the netflood connection will operate on
+ * \param callbacks Pointer to callback structure
+ *
+ *             This function opens an anycast connection like anycast_open()
+ *             and starts the Trickle timed advertisements of the anycast
+ *             addresses the node listens on or has learned a gradient for.
+ *             Every node of the network should use the proactive mode, so
+ *             that gradients can be built hop by hop. Data to an address
+ *             without a gradient is sent after a discovery as usual.
+ *
+ */
+void anycast_open_proactive(struct anycast_conn *c, uint16_t channels,
+	       const struct anycast_callbacks *callbacks);
+
 /**
  * \brief      Add an anycast address to listen on
  * \param c    A pointer to a struct anycast_conn
  * \param anycast_addr The anycast address on which to listen
- * \retval 0 if anycast_addr could be successfully added to the list bind_addrs, -1 otherwise
+ * \retval 0 once anycast_addr has been added to bind_map
  *
- *             This function adds an anycast address to the list of anycast addresses
- *             this server is listening on. This function must be called after anycast_open()
+ *             This function adds an anycast address to the set of anycast addresses
+ *             this server is listening on. There is no limit on the number of
+ *             addresses a server can listen on. This function must be called after anycast_open()
  *             and must be called separately for every anycast address the server supports.
  *
  */
 int anycast_listen_on(struct anycast_conn *c, const anycast_addr_t anycast_addr);
 
+/**
+ * \brief      Enable or disable eager mode
+ * \param c    A pointer to a struct anycast_conn
+ * \param on   Non-zero to enable eager mode, zero to disable it
+ *
+ *             In eager mode, anycast_send() puts data no longer than
+ *             ANYCAST_EAGER_LEN in the netflood packet itself. A server
+ *             reached by the flood delivers it to its recv callback once
+ *             and stops the flood there, saving the response and the mesh
+ *             route discoveries. The flood goes on along other paths, so
+ *             more than one server may deliver the data. The sent callback
+ *             is called once the flood has been started, as no response
+ *             comes back from a server. Eager mode is disabled by
+ *             anycast_open().
+ *
+ */
+void anycast_set_eager(struct anycast_conn *c, uint8_t on);
+
+/**
+ * \brief      Set the window to collect responses from anycast servers
+ * \param c    A pointer to a struct anycast_conn
+ * \param window Time to wait after the first response, zero to send immediately
+ *
+ *             Once the first server responded to a discovery, responses
+ *             from other servers are collected for window clock ticks and
+ *             the data is sent to the server with the fewest hops, where
+ *             a server counts up to ANYCAST_LOAD_HOPS hops more the higher
+ *             the load it declared. The window is applied to every
+ *             discovery started afterwards.
+ *             The window is zero after anycast_open(), i.e. the data is
+ *             sent to the first server that responded.
+ *
+ */
+void anycast_set_collect_window(struct anycast_conn *c, clock_time_t window);
+
+/**
+ * \brief      Set the load this server declares to clients
+ * \param c    A pointer to a struct anycast_conn
+ * \param load Load from 0, idle, to 255, saturated
+ *
+ *             The load is sent in every response to a discovery, so that
+ *             clients collecting responses spread their data over the
+ *             servers of an anycast address instead of all choosing the
+ *             nearest one. The server updates it as it sees fit, e.g. from
+ *             the depth of its receive queue or from its declared capacity.
+ *             Clients cache the load along with the server. The load is 0
+ *             after anycast_open().
+ *
+ */
+void anycast_set_load(struct anycast_conn *c, uint8_t load);
+
+/**
+ * \brief      Set the admission control thresholds of a server
+ * \param c    A pointer to a struct anycast_conn
+ * \param max_load Load at which discoveries are not answered, 0 for no limit
+ * \param max_rate Responses per ANYCAST_ADMIT_PERIOD at most, 0 for no limit
+ *
+ *             While the load set with anycast_set_load() reaches max_load,
+ *             or once max_rate discoveries have been answered in the current
+ *             period, the server forwards the discovery flood instead of
+ *             answering it. New clients then find the next nearest server.
+ *             Data from clients that already know the server is still
+ *             delivered. Both thresholds are 0 after anycast_open().
+ *
+ */
+void anycast_set_admission(struct anycast_conn *c, uint8_t max_load,
+	       uint8_t max_rate);
+
+/**
+ * \brief      Get the admission control thresholds and state of a server
+ * \param c    A pointer to a struct anycast_conn
+ * \return     A pointer to the admission state, valid until the connection is closed
+ */
+const struct anycast_admission *anycast_admission(struct anycast_conn *c);
+
+/**
+ * \brief      Enable or disable reliable mode
+ * \param c    A pointer to a struct anycast_conn
+ * \param on   Non-zero to enable reliable mode
+ *
+ *             In reliable mode the server acknowledges every packet and the
+ *             sent callback is only called once the acknowledgement arrived.
+ *             Unacknowledged packets are sent again with exponential backoff.
+ *             When the server keeps silent, the next nearest server that
+ *             answered the discovery is tried, then a new discovery is made.
+ *             The timedout callback with ERR_NO_ROUTE is called only when all
+ *             of these failed, so every packet ends with exactly one sent or
+ *             one timedout callback. Reliable packets do not use eager mode,
+ *             batching or the gradients of proactive mode. A runner-up server
+ *             is only known when a collection window is set.
+ *
+ */
+void anycast_set_reliable(struct anycast_conn *c, uint8_t on);
+
+/**
+ * \brief      Batch data sent to the same anycast server
+ * \param c    A pointer to a struct anycast_conn
+ * \param delay Time a batch waits for more data, 0 to disable batching
+ * \param threshold Size in bytes at which a batch is sent without waiting
+ *
+ *             When batching is enabled, data sent to a known server is not
+ *             sent right away but packed, with the length of every packet,
+ *             into a single frame. The frame is sent once delay is over, once
+ *             it holds threshold bytes or ANYCAST_BATCH_RECORDS packets, or
+ *             when data for another server comes in. The server delivers
+ *             every packet of the frame with its own recv callback.
+ *             Batching is disabled by default.
+ *
+ */
+void anycast_set_batching(struct anycast_conn *c, clock_time_t delay,
+	       uint8_t threshold);
+
 /**
  * \brief      Send an anycast packet
  * \param c    The anycast connection on which the packet should be sent
  * \param dest The anycast address of the virtual host this packet should be sent to
+ * \retval The handle of the packet, or ANYCAST_ERR_FULL, ANYCAST_ERR_INVALID
+ *	       or ANYCAST_ERR_UNREACHABLE
  *
  *             This function sends an anycast packet. The packet must be
  *             present in the packetbuf before this function is called.
+ *             All packetbuf_datalen() bytes are sent as they are, so the
+ *             packet may hold binary data of up to ANYCAST_DATA_LEN bytes.
+ *             While a server is being discovered the packet is held in a
+ *             queuebuf.
  *
  *             The parameter c must point to an anycast connection that
  *             must have previously been set up with anycast_open().
  *
+ *             If a discovery for dest is already in flight, the packet
+ *             joins it instead of flooding the network again, and is sent
+ *             to the server answering that discovery.
+ *
+ *             Every packet a handle is returned for ends with exactly one
+ *             sent or timedout callback carrying that handle, so that many
+ *             packets can be outstanding at a time. No callback is called
+ *             for a packet that was refused with a negative error code.
+ *             The callback may come before anycast_send() returns, e.g.
+ *             in eager mode, so the application must be ready for a handle
+ *             it has not stored yet. It may also come later for a packet
+ *             sent to a known server, once the batch is flushed or once
+ *             mesh has found a route, so no packet is known to complete
+ *             synchronously.
+ *
+ *             Once a discovery for dest found no server, packets that would
+ *             need a discovery are refused with ANYCAST_ERR_UNREACHABLE for
+ *             ANYCAST_UNREACHABLE_BACKOFF, twice as long after every further
+ *             failure, up to ANYCAST_UNREACHABLE_BACKOFF_MAX. The failures are
+ *             forgotten once a discovery finds a server for dest.
+ *
+ */
+int anycast_send(struct anycast_conn *c, const anycast_addr_t dest);
+
+/**
+ * \brief      Send a request that the server answers
+ * \param c    The anycast connection on which the request should be sent
+ * \param dest The anycast address of the virtual host this request should be sent to
+ * \retval The handle of the request, or ANYCAST_ERR_FULL, ANYCAST_ERR_INVALID
+ *	       or ANYCAST_ERR_UNREACHABLE
+ *
+ *             This function sends the packet in the packetbuf like
+ *             anycast_send(), to a cached server or after a discovery, but
+ *             never along a gradient or in eager mode. The server application
+ *             receives it with its recv callback and may answer with
+ *             anycast_reply(). The reply is handed to the response callback
+ *             with the handle of the request. If no reply arrives within
+ *             ANYCAST_RPC_TIMEOUT, the timedout callback is called with
+ *             ERR_NO_RESPONSE instead. No sent callback is called for a
+ *             request, and a request is not sent again.
+ *
+ */
+int anycast_request(struct anycast_conn *c, const anycast_addr_t dest);
+
+/**
+ * \brief      Reply to the request being received
+ * \param c    A pointer to a struct anycast_conn
+ * \retval 0 if the reply is being sent, ANYCAST_ERR_INVALID otherwise
+ *
+ *             This function sends the packet in the packetbuf back to the
+ *             client whose request is being delivered to the recv callback.
+ *             It must be called from that callback and answers the request
+ *             once. The reply follows the route the discovery and the request
+ *             established, without a route discovery of its own. The data of
+ *             the request lives in the packetbuf, so it must be read before
+ *             the reply is copied there.
+ *
+ */
+int anycast_reply(struct anycast_conn *c);
+
+/**
+ * \brief      Open a session to an anycast address
+ * \param c    The anycast connection the session sends on
+ * \param s    A pointer to a struct anycast_session
+ * \param addr The anycast address of the virtual host the session sends to
+ *
+ *             This function discovers the nearest server once, or takes it
+ *             from the cache, and binds the session to it. Data sent on the
+ *             session goes straight to that server, without discovery and
+ *             regardless of the lifetime of the cache. Every
+ *             ANYCAST_KEEPALIVE_INTERVAL a keepalive checks that the server
+ *             is reachable and still listens on addr. After
+ *             ANYCAST_KEEPALIVE_MISSES unanswered keepalives, the session
+ *             is bound to the server a new discovery chooses. The same
+ *             happens at once when mesh finds no route to the server, or
+ *             when a reliable or fragmented message to it fails. The caller must
+ *             have allocated the memory for the struct anycast_session,
+ *             usually by declaring it as a static variable.
+ *
+ */
+void anycast_session_open(struct anycast_conn *c, struct anycast_session *s,
+	       const anycast_addr_t addr);
+
+/**
+ * \brief      Send an anycast packet on a session
+ * \param s    A pointer to an open struct anycast_session
+ * \retval The handle of the packet, or ANYCAST_ERR_FULL or ANYCAST_ERR_INVALID
+ *
+ *             This function sends the packet in the packetbuf to the server
+ *             of the session, with the same callbacks as anycast_send().
+ *             Reliable mode applies, batching too. Until the session is bound,
+ *             the packet is sent with anycast_send().
+ *
+ */
+int anycast_session_send(struct anycast_session *s);
+
+/**
+ * \brief      Close a session
+ * \param s    A pointer to an open struct anycast_session
+ *
+ *             Packets already sent on the session are not affected.
+ *             anycast_close() closes the sessions of the connection.
+ *
+ */
+void anycast_session_close(struct anycast_session *s);
+
+/**
+ * \brief      Send a message larger than ANYCAST_DATA_LEN
+ * \param c    The anycast connection on which the message should be sent
+ * \param dest The anycast address of the virtual host this message should be sent to
+ * \param data A pointer to the message
+ * \param len  The length of the message in bytes, up to ANYCAST_MAX_MSG_LEN
+ * \retval The handle of the message, or ANYCAST_ERR_FULL, ANYCAST_ERR_INVALID
+ *	       or ANYCAST_ERR_UNREACHABLE
+ *
+ *             This function discovers the nearest server once and streams
+ *             the message to it in numbered fragments. The server reassembles
+ *             them and delivers the whole message with a single recv callback.
+ *             Fragments missing from the selective acknowledgement of the
+ *             server are sent again, up to ANYCAST_FRAG_RETRIES times.
+ *
+ *             The message is not copied, so data must stay valid until the
+ *             sent or timedout callback is called. Only one message can be
+ *             sent in fragments on a connection at a time; ANYCAST_ERR_FULL
+ *             is returned while another one is in flight.
+ *
  */
-void anycast_send(struct anycast_conn *c, const anycast_addr_t dest);
+int anycast_send_large(struct anycast_conn *c, const anycast_addr_t dest,
+	       const void *data, uint16_t len);
 
 /**
  * \brief      Close an anycast connection
  * \param c    A pointer to a struct anycast_conn
  *
  *             This function closes an anycast connection that has
- *             previously been opened with anycast_open().
+ *             previously been opened with anycast_open(). Every packet
+ *             still waiting for a server, an acknowledgement or a reply
+ *             gets its timedout callback before the function returns.
  *
  *             This function typically is called as an exit handler.
  *
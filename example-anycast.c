@@ -31,26 +31,29 @@ AUTOSTART_PROCESSES(&anycast_process);
 /*---------------------------------------------------------------------------*/
 void 
 anycast_recv(struct anycast_conn *c, const rimeaddr_t * originator,
-	const anycast_addr_t anycast_addr, char *data)
+	const anycast_addr_t anycast_addr, char *data, uint16_t len)
 {
 	printf("---------------App layer------------------\n");
-	printf("'%s' received on anycast service %u.\n", data, anycast_addr);
+	printf("'%.*s' received on anycast service %u.\n", len, data, anycast_addr);
 	printf("------------------------------------------\n");
 }
 /*---------------------------------------------------------------------------*/
 void 
-anycast_sent(struct anycast_conn *c, const anycast_addr_t anycast_addr, 
-	char *data)
+anycast_sent(struct anycast_conn *c, anycast_handle_t handle,
+	const anycast_addr_t anycast_addr, char *data, uint16_t len)
 {
 	printf("---------------App layer------------------\n");
-	printf("'%s' sent to anycast server %u.\n", data, anycast_addr);
+	printf("'%.*s' (#%d) sent to anycast server %u.\n", len, data, handle,
+		anycast_addr);
 	printf("------------------------------------------\n");
 }
 /*---------------------------------------------------------------------------*/
 void 
-anycast_timedout(struct anycast_conn *c, const uint8_t err_code)
+anycast_timedout(struct anycast_conn *c, anycast_handle_t handle,
+	const anycast_addr_t anycast_addr, const uint8_t err_code)
 {
 	printf("---------------App layer------------------\n");
+	printf("Packet #%d to anycast %u failed.\n", handle, anycast_addr);
 	if(err_code == ERR_NO_SERVER_FOUND) {
 		printf("Anycast server not found. (netflood failed)\n");
 	} else if (err_code == ERR_NO_ROUTE) {
@@ -96,14 +99,18 @@ PROCESS_THREAD(anycast_process, ev, data)
 			(data == &button_sensor || data == &button2_sensor));
 	
 		char buf[ANYCAST_DATA_LEN];
-		snprintf(buf, ANYCAST_DATA_LEN, "Hello from Gordon (node 9)");
-    		packetbuf_copyfrom(buf, sizeof(buf));
+		int handle;
+		int len = snprintf(buf, ANYCAST_DATA_LEN, "Hello from Gordon (node 9)");
+    		packetbuf_copyfrom(buf, len);
 		
 		if(data == &button_sensor) {
-    			anycast_send(&anycast, (uint8_t)S3_ANYCAST_SVC);
+    			handle = anycast_send(&anycast, (uint8_t)S3_ANYCAST_SVC);
     		} else {
-    			anycast_send(&anycast, (uint8_t)S2_ANYCAST_SVC);
+    			handle = anycast_send(&anycast, (uint8_t)S2_ANYCAST_SVC);
    		}
+		if(handle < 0) {
+			printf("Anycast send refused (%d).\n", handle);
+		}
 		FLASH_LED(LEDS_GREEN);
   	}
 